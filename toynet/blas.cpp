@@ -0,0 +1,381 @@
+#include <toynet/blas.h>
+#include <toynet/math.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#if defined(TOYNET_CBLAS)
+#include <cblas.h>
+#endif
+
+namespace toynet {
+
+namespace {
+
+// Split [0, n) in `threads` ranges whose bounds are multiples of `grain`, and
+// call f(begin, end) for each range in its own thread.  The work is done in
+// the calling thread when threads == 1.
+template<class F>
+void parallel_for(int n, int threads, int grain, F f)
+{
+    const int chunks = (n + grain - 1) / grain;
+    threads = std::max(1, std::min(threads, chunks));
+    if (threads == 1) {
+        f(0, n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0;  t < threads;  ++t) {
+        const int begin = std::min(n, int(long(chunks) * t / threads) * grain);
+        const int end = std::min(n, int(long(chunks) * (t + 1) / threads) * grain);
+        workers.emplace_back([&f, begin, end] { f(begin, end); });
+    }
+    for (auto& worker : workers)
+        worker.join();
+}
+
+// The number of threads worth starting for `work` multiply-adds: a thread
+// costs about as much as 2^16 of them
+int useful_threads(int threads, double work)
+{
+    return std::max(1, int(std::min<double>(threads, work / (1 << 16))));
+}
+
+// C = beta * C, for an M x N matrix C; C is not read when beta == 0
+template<class T>
+void scale_matrix(int M, int N, T beta, T* C, int ldc)
+{
+    if (beta == T(1))
+        return;
+    for (int i = 0;  i < M;  ++i) {
+        T* c = C + long(i) * ldc;
+        if (beta == T(0))
+            std::fill(c, c + N, T(0));
+        else
+            for (int j = 0;  j < N;  ++j)
+                c[j] *= beta;
+    }
+}
+
+#if !defined(TOYNET_CBLAS)
+
+// Register tile: each call of the micro-kernel computes an MR x NR block of C
+// in MR * NR accumulators.  The blocks of op(A) and op(B) are packed so that
+// the micro-kernel reads both with unit stride.
+const int MR = 4;
+const int NR = 8;
+// Cache blocks: a KC x NC panel of op(B) stays in L3 (2 MiB of doubles), and
+// an MC x KC block of op(A) in L2 (256 KiB of doubles), while the
+// micro-kernel sweeps over them
+const int KC = 256;
+const int MC = 128;
+const int NC = 1024;
+
+// op(X) for a row-major X with leading dimension `ld`
+template<class T>
+struct OpMatrix {
+    T operator()(int i, int j) const
+    {
+        return trans == Trans::no ? p[long(i) * ld + j] : p[long(j) * ld + i];
+    }
+
+    // op(X) without its first `i` rows and `j` columns
+    OpMatrix shift(int i, int j) const
+    {
+        return {trans == Trans::no ? p + long(i) * ld + j : p + long(j) * ld + i, ld, trans};
+    }
+
+    const T* p;
+    int ld;
+    Trans trans;
+};
+
+// Copy the mc x kc block of alpha * op(A) in slivers of MR rows, stored
+// column after column and padded with zeros
+template<class T>
+void pack_a(const OpMatrix<T>& a, int mc, int kc, T alpha, T* out)
+{
+    for (int i = 0;  i < mc;  i += MR)
+        for (int p = 0;  p < kc;  ++p)
+            for (int r = 0;  r < MR;  ++r)
+                *out++ = i + r < mc ? alpha * a(i + r, p) : T(0);
+}
+
+// Copy the kc x nc block of op(B) in slivers of NR columns, stored row after
+// row and padded with zeros
+template<class T>
+void pack_b(const OpMatrix<T>& b, int kc, int nc, T* out)
+{
+    for (int j = 0;  j < nc;  j += NR)
+        for (int p = 0;  p < kc;  ++p)
+            for (int s = 0;  s < NR;  ++s)
+                *out++ = j + s < nc ? b(p, j + s) : T(0);
+}
+
+// C += a * b for an MR x kc sliver `a` and a kc x NR sliver `b`, of which
+// only the top-left m x n block is stored to C
+template<class T>
+inline __attribute__((always_inline))
+void micro_kernel_impl(int kc, const T* a, const T* b, T* C, int ldc, int m, int n)
+{
+    T acc[MR][NR] = {};
+    for (int p = 0;  p < kc;  ++p, a += MR, b += NR)
+        for (int r = 0;  r < MR;  ++r)
+            for (int s = 0;  s < NR;  ++s)
+                acc[r][s] += a[r] * b[s];
+    for (int r = 0;  r < m;  ++r)
+        for (int s = 0;  s < n;  ++s)
+            C[long(r) * ldc + s] += acc[r][s];
+}
+
+// The micro-kernel compiled for each SIMD level, so that the compiler
+// vectorizes the accumulators with the widest registers available
+template<class T>
+void micro_kernel_scalar(int kc, const T* a, const T* b, T* C, int ldc, int m, int n)
+{
+    micro_kernel_impl(kc, a, b, C, ldc, m, n);
+}
+
+#if defined(__x86_64__)
+
+template<class T>
+__attribute__((target("avx2,fma")))
+void micro_kernel_avx2(int kc, const T* a, const T* b, T* C, int ldc, int m, int n)
+{
+    micro_kernel_impl(kc, a, b, C, ldc, m, n);
+}
+
+template<class T>
+__attribute__((target("avx512f")))
+void micro_kernel_avx512(int kc, const T* a, const T* b, T* C, int ldc, int m, int n)
+{
+    micro_kernel_impl(kc, a, b, C, ldc, m, n);
+}
+
+#endif
+
+template<class T>
+using MicroKernel = void (*)(int, const T*, const T*, T*, int, int, int);
+
+template<class T>
+MicroKernel<T> micro_kernel()
+{
+#if defined(__x86_64__)
+    switch (simd_level()) {
+      case SimdLevel::avx512: return micro_kernel_avx512<T>;
+      case SimdLevel::avx2: return micro_kernel_avx2<T>;
+      default: break;
+    }
+#endif
+    return micro_kernel_scalar<T>;
+}
+
+// C += alpha * op(A) * op(B), in a single thread
+template<class T>
+void gemm_serial(const OpMatrix<T>& A, const OpMatrix<T>& B, int M, int N, int K, T alpha, T* C, int ldc)
+{
+    const MicroKernel<T> kernel = micro_kernel<T>();
+    std::vector<T> a(std::size_t(std::min(MC, (M + MR - 1) / MR * MR)) * std::min(KC, K));
+    std::vector<T> b(std::size_t(std::min(NC, (N + NR - 1) / NR * NR)) * std::min(KC, K));
+    for (int j0 = 0;  j0 < N;  j0 += NC) {
+        const int nc = std::min(NC, N - j0);
+        for (int p0 = 0;  p0 < K;  p0 += KC) {
+            const int kc = std::min(KC, K - p0);
+            pack_b(B.shift(p0, j0), kc, nc, b.data());
+            for (int i0 = 0;  i0 < M;  i0 += MC) {
+                const int mc = std::min(MC, M - i0);
+                pack_a(A.shift(i0, p0), mc, kc, alpha, a.data());
+                for (int j = 0;  j < nc;  j += NR)
+                    for (int i = 0;  i < mc;  i += MR)
+                        kernel(kc, &a[std::size_t(i) * kc], &b[std::size_t(j) * kc],
+                               C + long(i0 + i) * ldc + j0 + j, ldc,
+                               std::min(MR, mc - i), std::min(NR, nc - j));
+            }
+        }
+    }
+}
+
+// The rows or the columns of C, whichever are more numerous, are split
+// across the threads
+template<class T>
+void builtin_gemm(Trans transA, Trans transB, int M, int N, int K,
+                  T alpha, const T* A, int lda, const T* B, int ldb,
+                  T beta, T* C, int ldc, int threads)
+{
+    const OpMatrix<T> a{A, lda, transA};
+    const OpMatrix<T> b{B, ldb, transB};
+    threads = useful_threads(threads, double(M) * N * K);
+    if (M >= N) {
+        parallel_for(M, threads, MR, [&](int begin, int end) {
+            scale_matrix(end - begin, N, beta, C + long(begin) * ldc, ldc);
+            if (alpha != T(0))
+                gemm_serial(a.shift(begin, 0), b, end - begin, N, K, alpha, C + long(begin) * ldc, ldc);
+        });
+    } else {
+        parallel_for(N, threads, NR, [&](int begin, int end) {
+            scale_matrix(M, end - begin, beta, C + begin, ldc);
+            if (alpha != T(0))
+                gemm_serial(a, b.shift(0, begin), M, end - begin, K, alpha, C + begin, ldc);
+        });
+    }
+}
+
+// y = alpha * A * x + beta * y splits the rows of A across the threads, and
+// y = alpha * trans(A) * x + beta * y splits the columns, so that each
+// thread owns its part of y
+template<class T>
+void builtin_gemv(Trans trans, int M, int N, T alpha, const T* A, int lda,
+                  const T* x, T beta, T* y, int threads)
+{
+    threads = useful_threads(threads, double(M) * N);
+    if (trans == Trans::no) {
+        parallel_for(M, threads, 16, [&](int begin, int end) {
+            for (int i = begin;  i < end;  ++i) {
+                const T d = alpha * simd_dot(A + long(i) * lda, x, N);
+                y[i] = beta == T(0) ? d : d + beta * y[i];
+            }
+        });
+    } else {
+        parallel_for(N, threads, 16, [&](int begin, int end) {
+            scale_matrix(1, end - begin, beta, y + begin, 0);
+            for (int i = 0;  i < M;  ++i) {
+                const T a = alpha * x[i];
+                const T* row = A + long(i) * lda;
+                for (int j = begin;  j < end;  ++j)
+                    y[j] += a * row[j];
+            }
+        });
+    }
+}
+
+template<class T>
+void builtin_ger(int M, int N, T alpha, const T* x, const T* y, T* A, int lda, int threads)
+{
+    threads = useful_threads(threads, double(M) * N);
+    parallel_for(M, threads, 1, [&](int begin, int end) {
+        for (int i = begin;  i < end;  ++i) {
+            const T a = alpha * x[i];
+            T* row = A + long(i) * lda;
+            for (int j = 0;  j < N;  ++j)
+                row[j] += a * y[j];
+        }
+    });
+}
+
+#else
+
+CBLAS_TRANSPOSE cblas_trans(Trans trans)
+{
+    return trans == Trans::no ? CblasNoTrans : CblasTrans;
+}
+
+#endif
+
+} // namespace
+
+const char* blas_backend()
+{
+#if defined(TOYNET_CBLAS)
+    return "cblas";
+#else
+    return "builtin";
+#endif
+}
+
+// The public functions handle the empty products, so that the backends never
+// see a zero dimension
+
+void gemm(Trans transA, Trans transB, int M, int N, int K,
+          double alpha, const double* A, int lda, const double* B, int ldb,
+          double beta, double* C, int ldc, int threads)
+{
+    if (M == 0 || N == 0)
+        return;
+    if (K == 0) {
+        scale_matrix(M, N, beta, C, ldc);
+        return;
+    }
+#if defined(TOYNET_CBLAS)
+    cblas_dgemm(CblasRowMajor, cblas_trans(transA), cblas_trans(transB), M, N, K,
+                alpha, A, lda, B, ldb, beta, C, ldc);
+#else
+    builtin_gemm(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, threads);
+#endif
+}
+
+void gemm(Trans transA, Trans transB, int M, int N, int K,
+          float alpha, const float* A, int lda, const float* B, int ldb,
+          float beta, float* C, int ldc, int threads)
+{
+    if (M == 0 || N == 0)
+        return;
+    if (K == 0) {
+        scale_matrix(M, N, beta, C, ldc);
+        return;
+    }
+#if defined(TOYNET_CBLAS)
+    cblas_sgemm(CblasRowMajor, cblas_trans(transA), cblas_trans(transB), M, N, K,
+                alpha, A, lda, B, ldb, beta, C, ldc);
+#else
+    builtin_gemm(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, threads);
+#endif
+}
+
+void gemv(Trans trans, int M, int N, double alpha, const double* A, int lda,
+          const double* x, double beta, double* y, int threads)
+{
+    const int rows = trans == Trans::no ? M : N;
+    const int cols = trans == Trans::no ? N : M;
+    if (rows == 0)
+        return;
+    if (cols == 0) {
+        scale_matrix(1, rows, beta, y, 0);
+        return;
+    }
+#if defined(TOYNET_CBLAS)
+    cblas_dgemv(CblasRowMajor, cblas_trans(trans), M, N, alpha, A, lda, x, 1, beta, y, 1);
+#else
+    builtin_gemv(trans, M, N, alpha, A, lda, x, beta, y, threads);
+#endif
+}
+
+void gemv(Trans trans, int M, int N, float alpha, const float* A, int lda,
+          const float* x, float beta, float* y, int threads)
+{
+    const int rows = trans == Trans::no ? M : N;
+    const int cols = trans == Trans::no ? N : M;
+    if (rows == 0)
+        return;
+    if (cols == 0) {
+        scale_matrix(1, rows, beta, y, 0);
+        return;
+    }
+#if defined(TOYNET_CBLAS)
+    cblas_sgemv(CblasRowMajor, cblas_trans(trans), M, N, alpha, A, lda, x, 1, beta, y, 1);
+#else
+    builtin_gemv(trans, M, N, alpha, A, lda, x, beta, y, threads);
+#endif
+}
+
+void ger(int M, int N, double alpha, const double* x, const double* y, double* A, int lda, int threads)
+{
+    if (M == 0 || N == 0)
+        return;
+#if defined(TOYNET_CBLAS)
+    cblas_dger(CblasRowMajor, M, N, alpha, x, 1, y, 1, A, lda);
+#else
+    builtin_ger(M, N, alpha, x, y, A, lda, threads);
+#endif
+}
+
+void ger(int M, int N, float alpha, const float* x, const float* y, float* A, int lda, int threads)
+{
+    if (M == 0 || N == 0)
+        return;
+#if defined(TOYNET_CBLAS)
+    cblas_sger(CblasRowMajor, M, N, alpha, x, 1, y, 1, A, lda);
+#else
+    builtin_ger(M, N, alpha, x, y, A, lda, threads);
+#endif
+}
+
+} // namespace toynet
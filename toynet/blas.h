@@ -0,0 +1,42 @@
+namespace toynet {
+
+// Dense matrix products over raw row-major storage, with the conventions of
+// CBLAS: `op(X)` is X or its transpose, and each matrix has a leading
+// dimension (the distance between the starts of two consecutive rows, at
+// least its number of columns).  The built-in implementation is cache- and
+// register-blocked and can split the work across `threads` threads; when
+// toynet is configured with -DTOYNET_CBLAS=ON, the products call the CBLAS
+// library instead, which manages its own threads and ignores `threads`.
+
+enum class Trans { no, yes };
+
+// The name of the implementation: "builtin" or "cblas"
+const char* blas_backend();
+
+// C = alpha * op(A) * op(B) + beta * C, where op(A) is M x K, op(B) is K x N
+// and C is M x N.  C is not read when beta == 0.
+// pre-condition: threads >= 1
+void gemm(Trans transA, Trans transB, int M, int N, int K,
+          double alpha, const double* A, int lda, const double* B, int ldb,
+          double beta, double* C, int ldc, int threads=1);
+
+void gemm(Trans transA, Trans transB, int M, int N, int K,
+          float alpha, const float* A, int lda, const float* B, int ldb,
+          float beta, float* C, int ldc, int threads=1);
+
+// y = alpha * op(A) * x + beta * y, where A is M x N (before `op`).  y is not
+// read when beta == 0.
+// pre-condition: threads >= 1
+void gemv(Trans trans, int M, int N, double alpha, const double* A, int lda,
+          const double* x, double beta, double* y, int threads=1);
+
+void gemv(Trans trans, int M, int N, float alpha, const float* A, int lda,
+          const float* x, float beta, float* y, int threads=1);
+
+// A += alpha * x * trans(y), where A is M x N, x has M elements and y has N
+// pre-condition: threads >= 1
+void ger(int M, int N, double alpha, const double* x, const double* y, double* A, int lda, int threads=1);
+
+void ger(int M, int N, float alpha, const float* x, const float* y, float* A, int lda, int threads=1);
+
+} // namespace toynet
@@ -0,0 +1,130 @@
+#include <toynet/blas.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+namespace {
+
+template<class T>
+std::vector<T> random_values(std::size_t n, std::mt19937& rng)
+{
+    std::uniform_real_distribution<T> dist(-1.0, 1.0);
+    std::vector<T> ret(n);
+    for (T& x : ret)
+        x = dist(rng);
+    return ret;
+}
+
+// op(X)(i, j) for a row-major X with leading dimension `ld`
+template<class T>
+T op(const std::vector<T>& x, int ld, Trans trans, int i, int j)
+{
+    return trans == Trans::no ? x[i * ld + j] : x[j * ld + i];
+}
+
+template<class T>
+void help_test_gemm(double tol)
+{
+    std::mt19937 rng(0);
+    // Include sizes that are not multiples of the register tile, and sizes
+    // larger than the cache blocks
+    for (int M : {1, 5, 130})
+    for (int N : {1, 9, 1030})
+    for (int K : {0, 3, 260})
+    for (Trans ta : {Trans::no, Trans::yes})
+    for (Trans tb : {Trans::no, Trans::yes})
+    for (int threads : {1, 3}) {
+        if (M * N * K > 5000000 && (ta == Trans::yes || threads == 1))
+            continue;
+        // leading dimensions larger than the rows
+        const int lda = (ta == Trans::no ? K : M) + 2;
+        const int ldb = (tb == Trans::no ? N : K) + 1;
+        const int ldc = N + 3;
+        const std::vector<T> a = random_values<T>((ta == Trans::no ? M : K) * lda, rng);
+        const std::vector<T> b = random_values<T>((tb == Trans::no ? K : N) * ldb, rng);
+        const std::vector<T> c0 = random_values<T>(M * ldc, rng);
+        const T alpha = 0.5, beta = -2;
+        std::vector<T> c = c0;
+        gemm(ta, tb, M, N, K, alpha, a.data(), lda, b.data(), ldb, beta, c.data(), ldc, threads);
+        for (int i = 0;  i < M;  ++i) {
+            for (int j = 0;  j < ldc;  ++j) {
+                if (j >= N) {
+                    BOOST_REQUIRE_EQUAL(c0[i * ldc + j], c[i * ldc + j]);
+                    continue;
+                }
+                double expected = beta * c0[i * ldc + j];
+                for (int k = 0;  k < K;  ++k)
+                    expected += alpha * double(op(a, lda, ta, i, k)) * op(b, ldb, tb, k, j);
+                BOOST_REQUIRE_SMALL(expected - c[i * ldc + j], tol);
+            }
+        }
+    }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(gemm_double)
+{
+    BOOST_TEST_MESSAGE("backend " << blas_backend());
+    help_test_gemm<double>(1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(gemm_float)
+{
+    help_test_gemm<float>(1e-3);
+}
+
+BOOST_AUTO_TEST_CASE(gemm_beta_0)
+{
+    // C is not read when beta == 0, so NaNs in C do not propagate
+    const std::vector<double> a{1, 2, 3, 4};
+    const std::vector<double> b{5, 6, 7, 8};
+    std::vector<double> c(4, std::numeric_limits<double>::quiet_NaN());
+    gemm(Trans::no, Trans::no, 2, 2, 2, 1.0, a.data(), 2, b.data(), 2, 0.0, c.data(), 2);
+    BOOST_CHECK((c == std::vector<double>{19, 22, 43, 50}));
+    std::fill(c.begin(), c.end(), std::numeric_limits<double>::quiet_NaN());
+    gemm(Trans::no, Trans::no, 2, 2, 0, 1.0, a.data(), 1, b.data(), 2, 0.0, c.data(), 2);
+    BOOST_CHECK((c == std::vector<double>{0, 0, 0, 0}));
+}
+
+BOOST_AUTO_TEST_CASE(gemv_ger)
+{
+    std::mt19937 rng(1);
+    for (int M : {0, 1, 7, 300})
+    for (int N : {0, 1, 5, 200})
+    for (int threads : {1, 4}) {
+        const int lda = N + 1;
+        const std::vector<double> a = random_values<double>(M * lda, rng);
+        const std::vector<double> x = random_values<double>(std::max(M, N), rng);
+        const std::vector<double> y0 = random_values<double>(std::max(M, N), rng);
+        // y = 2 * A * x - y
+        std::vector<double> y = y0;
+        gemv(Trans::no, M, N, 2.0, a.data(), lda, x.data(), -1.0, y.data(), threads);
+        for (int i = 0;  i < M;  ++i) {
+            double expected = -y0[i];
+            for (int j = 0;  j < N;  ++j)
+                expected += 2.0 * a[i * lda + j] * x[j];
+            BOOST_REQUIRE_SMALL(expected - y[i], 1e-10);
+        }
+        // y = 2 * trans(A) * x - y
+        y = y0;
+        gemv(Trans::yes, M, N, 2.0, a.data(), lda, x.data(), -1.0, y.data(), threads);
+        for (int j = 0;  j < N;  ++j) {
+            double expected = -y0[j];
+            for (int i = 0;  i < M;  ++i)
+                expected += 2.0 * a[i * lda + j] * x[i];
+            BOOST_REQUIRE_SMALL(expected - y[j], 1e-10);
+        }
+        // A += 2 * x * trans(y)
+        std::vector<double> b = a;
+        ger(M, N, 2.0, x.data(), y0.data(), b.data(), lda, threads);
+        for (int i = 0;  i < M;  ++i)
+            for (int j = 0;  j < lda;  ++j)
+                BOOST_REQUIRE_SMALL(a[i * lda + j] + (j < N ? 2.0 * x[i] * y0[j] : 0.0) - b[i * lda + j], 1e-12);
+    }
+}
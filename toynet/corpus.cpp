@@ -0,0 +1,131 @@
+#include <toynet/corpus.h>
+#include <toynet/mapped_file.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace toynet {
+
+namespace {
+
+// See `Corpus`
+struct CorpusHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t W;
+    std::uint64_t size;
+    char reserved[8];
+};
+
+static_assert(sizeof(CorpusHeader) == 32, "CorpusHeader must be 32 bytes");
+
+const char corpus_magic[8] = {'T', 'O', 'Y', 'N', 'E', 'T', 'C', '1'};
+const std::uint32_t corpus_version = 1;
+
+} // namespace
+
+Corpus::Corpus()
+    : W(0)
+    , words(nullptr)
+    , n(0)
+{
+}
+
+Corpus::Corpus(const std::vector<int>& words)
+    : W(words.empty() ? 0 : *std::max_element(words.begin(), words.end()) + 1)
+    , counts(W, 0)
+    // int and std::uint32_t may alias each other
+    , words(reinterpret_cast<const std::uint32_t*>(words.data()))
+    , n(words.size())
+{
+    for (int w : words)
+        ++counts[w];
+}
+
+Corpus::Corpus(const std::string& path)
+    : file(std::make_shared<MappedFile>(path))
+{
+    CorpusHeader h;
+    if (file->size < sizeof(h))
+        throw std::runtime_error("Corpus: truncated corpus file " + path);
+    std::memcpy(&h, file->data, sizeof(h));
+    if (std::memcmp(h.magic, corpus_magic, sizeof(corpus_magic)) != 0)
+        throw std::runtime_error("Corpus: not a corpus file " + path);
+    if (h.version != corpus_version)
+        throw std::runtime_error("Corpus: unsupported corpus file version " + std::to_string(h.version));
+    if (h.W > std::uint32_t(std::numeric_limits<int>::max()))
+        throw std::runtime_error("Corpus: corrupted corpus file header " + path);
+    // h.size * 4 must not overflow
+    if (h.size > (file->size - sizeof(h)) / 4
+        || file->size != sizeof(h) + h.size * 4 + std::uint64_t(h.W) * 8)
+        throw std::runtime_error("Corpus: truncated corpus file " + path);
+    W = h.W;
+    n = h.size;
+    words = reinterpret_cast<const std::uint32_t*>(file->data + sizeof(h));
+    // Word indices are used to index the rows of the models; as unsigned
+    // integers, this also rejects the ones that would be negative as `int`
+    for (std::size_t i = 0;  i < n;  ++i)
+        if (words[i] >= std::uint32_t(W))
+            throw std::runtime_error("Corpus: word index out of range in corpus file " + path);
+    std::vector<std::int64_t> raw(W);
+    if (W > 0)
+        std::memcpy(raw.data(), file->data + sizeof(h) + n * 4, raw.size() * 8);
+    counts.assign(raw.begin(), raw.end());
+}
+
+CorpusWriter::CorpusWriter(const std::string& path)
+    : os(path, std::ios::binary | std::ios::trunc)
+    , path(path)
+    , n(0)
+{
+    if (!os)
+        throw std::runtime_error("CorpusWriter: cannot create " + path);
+    // Placeholder, overwritten by close()
+    const CorpusHeader h = {};
+    os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+}
+
+CorpusWriter::~CorpusWriter()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+void CorpusWriter::write(int word)
+{
+    const std::uint32_t w = word;
+    os.write(reinterpret_cast<const char*>(&w), sizeof(w));
+    if (word >= counts.size())
+        counts.resize(word + 1, 0);
+    ++counts[word];
+    ++n;
+}
+
+void CorpusWriter::write(const std::vector<int>& words)
+{
+    for (int w : words)
+        write(w);
+}
+
+void CorpusWriter::close()
+{
+    if (!os.is_open())
+        return;
+    const std::vector<std::int64_t> raw(counts.begin(), counts.end());
+    os.write(reinterpret_cast<const char*>(raw.data()), raw.size() * 8);
+    CorpusHeader h = {};
+    std::memcpy(h.magic, corpus_magic, sizeof(corpus_magic));
+    h.version = corpus_version;
+    h.W = counts.size();
+    h.size = n;
+    os.seekp(0);
+    os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    os.close();
+    if (!os)
+        throw std::runtime_error("CorpusWriter: cannot write " + path);
+}
+
+} // namespace toynet
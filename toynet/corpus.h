@@ -0,0 +1,88 @@
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace toynet {
+
+struct MappedFile;
+
+// A read-only sequence of word indices, with the number of words W of its
+// vocabulary and the count of each word.  A corpus is either a view of a
+// `std::vector<int>` or a corpus file, which is memory-mapped and used in
+// place: the word indices are never copied, and only the pages being read
+// need to be in memory, so a corpus can be much larger than RAM.
+// A corpus file, as written by `CorpusWriter`, is made of:
+// - a 32-byte header: the magic string "TOYNETC1" (8 bytes), the format
+//   version and W (4-byte integers), then the number of words in the corpus
+//   (8 bytes), padded with zeros
+// - the word indices, as 4-byte unsigned integers
+// - the count of each word of the vocabulary, as 8-byte integers
+// All values are in native byte order.
+struct Corpus {
+    Corpus();
+
+    // A view of `words`, which must outlive the corpus.  W and the counts
+    // are computed by scanning `words` once.
+    // Pre-conditions: for each `w` in `words`: w >= 0
+    Corpus(const std::vector<int>& words);
+
+    // A temporary vector would not outlive the corpus
+    Corpus(std::vector<int>&& words) = delete;
+
+    // Map the corpus file at `path`.  W and the counts are read from the
+    // file, and the word indices are scanned once to check that they are in
+    // [0, W).
+    // Throws std::runtime_error if the file is not a valid corpus file.
+    explicit Corpus(const std::string& path);
+
+    // The number of words in the corpus
+    std::size_t size() const { return n; }
+
+    bool empty() const { return n == 0; }
+
+    int operator[](std::size_t i) const { return words[i]; }
+
+    int W;
+    // counts[w] is the number of times word `w` appears in the corpus
+    std::vector<long> counts;
+    const std::uint32_t* words;
+    std::size_t n;
+    // Keeps a corpus file mapped
+    std::shared_ptr<MappedFile> file;
+};
+
+// Writes a corpus file (see `Corpus`) one word index at a time, so that the
+// corpus never has to be in memory.
+struct CorpusWriter {
+    // Create or truncate the file at `path`.
+    // Throws std::runtime_error if the file cannot be created.
+    explicit CorpusWriter(const std::string& path);
+
+    // Calls `close()`
+    ~CorpusWriter();
+
+    CorpusWriter(const CorpusWriter&) = delete;
+    CorpusWriter& operator=(const CorpusWriter&) = delete;
+
+    // Append word index `word` to the corpus
+    // Pre-conditions: word >= 0
+    void write(int word);
+
+    // Append all the word indices of `words`
+    void write(const std::vector<int>& words);
+
+    // Write the counts and the header, and close the file.  Does nothing if
+    // the file is already closed.
+    // Throws std::runtime_error if writing fails.
+    void close();
+
+    std::ofstream os;
+    std::string path;
+    std::vector<long> counts;
+    std::uint64_t n;
+};
+
+} // namespace toynet
@@ -0,0 +1,106 @@
+#include <toynet/corpus.h>
+#include <toynet/stlio.h>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+BOOST_AUTO_TEST_CASE(Corpus_default)
+{
+    const Corpus corpus;
+    BOOST_CHECK_EQUAL(0, corpus.size());
+    BOOST_CHECK(corpus.empty());
+    BOOST_CHECK_EQUAL(0, corpus.W);
+}
+
+BOOST_AUTO_TEST_CASE(Corpus_vector)
+{
+    const std::vector<int> words{3, 0, 3, 1, 3};
+    const Corpus corpus(words);
+    BOOST_REQUIRE_EQUAL(5, corpus.size());
+    for (int i = 0;  i < 5;  ++i)
+        BOOST_CHECK_EQUAL(words[i], corpus[i]);
+    BOOST_CHECK_EQUAL(4, corpus.W);
+    BOOST_CHECK_EQUAL(std::vector<long>({1, 1, 0, 3}), corpus.counts);
+    BOOST_CHECK(corpus.file == nullptr);
+    // A view of a temporary would dangle
+    static_assert(std::is_convertible<const std::vector<int>&, Corpus>::value);
+    static_assert(!std::is_convertible<std::vector<int>&&, Corpus>::value);
+}
+
+BOOST_AUTO_TEST_CASE(Corpus_file)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Corpus_file").string();
+    const std::vector<int> words{3, 0, 3, 1, 3, 5};
+    {
+        CorpusWriter writer(path);
+        writer.write(3);
+        writer.write(std::vector<int>(words.begin() + 1, words.end()));
+    }
+    const Corpus corpus(path);
+    std::remove(path.c_str());  // the mapping outlives the file name
+    BOOST_REQUIRE_EQUAL(6, corpus.size());
+    for (int i = 0;  i < 6;  ++i)
+        BOOST_CHECK_EQUAL(words[i], corpus[i]);
+    BOOST_CHECK_EQUAL(6, corpus.W);
+    BOOST_CHECK_EQUAL(std::vector<long>({1, 1, 0, 3, 0, 1}), corpus.counts);
+    BOOST_CHECK(corpus.file != nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(Corpus_file_empty)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Corpus_file_empty").string();
+    CorpusWriter(path).close();
+    const Corpus corpus(path);
+    std::remove(path.c_str());
+    BOOST_CHECK(corpus.empty());
+    BOOST_CHECK_EQUAL(0, corpus.W);
+}
+
+BOOST_AUTO_TEST_CASE(Corpus_file_errors)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Corpus_file_errors").string();
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << "not a corpus file, but long enough for a header";
+    }
+    BOOST_CHECK_THROW(Corpus corpus(path), std::runtime_error);
+    {
+        CorpusWriter writer(path);
+        writer.write({1, 2, 3});
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    BOOST_CHECK_THROW(Corpus corpus(path), std::runtime_error);
+    // A word count so large that size * 4 overflows
+    {
+        CorpusWriter writer(path);
+        writer.write({1, 2, 3});
+    }
+    {
+        std::fstream fs(path, std::ios::binary | std::ios::in | std::ios::out);
+        const std::uint64_t size = std::uint64_t(1) << 62;
+        fs.seekp(16);
+        fs.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    }
+    BOOST_CHECK_THROW(Corpus corpus(path), std::runtime_error);
+    // Word indices that are negative as `int`, or not less than W
+    for (std::uint32_t word : {std::uint32_t(0xffffffff), std::uint32_t(4)}) {
+        {
+            CorpusWriter writer(path);
+            writer.write({1, 2, 3});
+        }
+        {
+            std::fstream fs(path, std::ios::binary | std::ios::in | std::ios::out);
+            fs.seekp(32 + 4);
+            fs.write(reinterpret_cast<const char*>(&word), sizeof(word));
+        }
+        BOOST_CHECK_THROW(Corpus corpus(path), std::runtime_error);
+    }
+    std::remove(path.c_str());
+    BOOST_CHECK_THROW(Corpus corpus(path), std::runtime_error);
+}
@@ -1,4 +1,5 @@
 #include <toynet/examples/diff2/diff2.h>
+#include <toynet/blas.h>
 #include <toynet/math.h>
 #include <toynet/stlio.h>
 #include <toynet/ublas/io.h>
@@ -79,8 +80,13 @@ Tensor1D Network::predict(const Tensor1D& x) const
 void Network::forward(Workspace& workspace, const Tensor1D& x) const
 {
     workspace.A[0] = x;  // input layer
-    for (int i = 0;  i < hidden+1;  ++i)
-        workspace.A[i+1] = ublas::prod(W[i], workspace.A[i]);  // hidden and output layers
+    for (int i = 0;  i < hidden+1;  ++i) {
+        // hidden and output layers: A[i+1] = W[i] * A[i]
+        Tensor1D& a = workspace.A[i+1];
+        a.resize(W[i].size1(), false);
+        gemv(Trans::no, W[i].size1(), W[i].size2(), 1.0, W[i].data().begin(), W[i].size2(),
+             workspace.A[i].data().begin(), 0.0, a.data().begin());
+    }
 }
 
 void Workspace::init_before_epoch()
@@ -117,8 +123,17 @@ void GradientOptimizer::compute_gradients(const Network& network, Workspace& wor
 {
     std::tie(workspace.loss, (*workspace.dA)[network.hidden+1]) = loss(y, workspace.A[network.hidden+1]);
     for (int i = network.hidden;  i >= 0;  --i) {
-        (*workspace.dW)[i] = ublas::outer_prod((*workspace.dA)[i+1], ublas::trans(workspace.A[i]));
-        (*workspace.dA)[i] = ublas::prod(ublas::trans(network.W[i]), (*workspace.dA)[i+1]);
+        const Tensor2D& W = network.W[i];
+        const Tensor1D& dA = (*workspace.dA)[i+1];
+        // dW[i] = dA[i+1] * trans(A[i])
+        Tensor2D& dW = (*workspace.dW)[i];
+        dW.resize(W.size1(), W.size2(), false);
+        std::fill(dW.data().begin(), dW.data().end(), 0.0);
+        ger(W.size1(), W.size2(), 1.0, dA.data().begin(), workspace.A[i].data().begin(), dW.data().begin(), W.size2());
+        // dA[i] = trans(W[i]) * dA[i+1]
+        (*workspace.dA)[i].resize(W.size2(), false);
+        gemv(Trans::yes, W.size1(), W.size2(), 1.0, W.data().begin(), W.size2(),
+             dA.data().begin(), 0.0, (*workspace.dA)[i].data().begin());
     }
 }
 
@@ -0,0 +1,230 @@
+#include <toynet/hnsw.h>
+#include <toynet/math.h>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <random>
+#include <unordered_set>
+
+namespace toynet {
+
+namespace {
+
+// Copy `n` scalars to `out`, scaled to unit length (zero vectors stay zero)
+template<class T>
+void normalize_into(const T* x, int n, float* out)
+{
+    double norm = 0.0;
+    for (int i = 0;  i < n;  ++i)
+        norm += double(x[i]) * x[i];
+    norm = std::sqrt(norm);
+    for (int i = 0;  i < n;  ++i)
+        out[i] = norm > 0.0 ? x[i] / norm : 0.0;
+}
+
+template<class T>
+void build(HNSWIndex& index, const BasicEmbeddingMatrix<T>& points, unsigned int seed)
+{
+    const int N = points.size1();
+    const int D = points.size2();
+    index.vectors.resize(std::size_t(N) * D);
+    for (int i = 0;  i < N;  ++i)
+        normalize_into(&points.data()[0] + std::size_t(i) * D, D, &index.vectors[std::size_t(i) * D]);
+    index.links.resize(N);
+    // P(level >= l) = M^-l
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    const double mL = 1.0 / std::log(index.M);
+    for (int i = 0;  i < N;  ++i) {
+        const int level = -std::log(1.0 - dist(rng)) * mL;
+        index.insert(i, level);
+    }
+}
+
+} // namespace
+
+HNSWIndex::HNSWIndex(const BasicEmbeddingMatrix<double>& points, int M, int efConstruction, unsigned int seed)
+    : D(points.size2())
+    , M(M)
+    , efConstruction(efConstruction)
+    , entry(-1)
+    , maxLevel(-1)
+{
+    build(*this, points, seed);
+}
+
+HNSWIndex::HNSWIndex(const BasicEmbeddingMatrix<float>& points, int M, int efConstruction, unsigned int seed)
+    : D(points.size2())
+    , M(M)
+    , efConstruction(efConstruction)
+    , entry(-1)
+    , maxLevel(-1)
+{
+    build(*this, points, seed);
+}
+
+void HNSWIndex::save(std::ostream& os) const
+{
+    boost::archive::binary_oarchive oa(os);
+    oa << *this;
+}
+
+void HNSWIndex::load(std::istream& is)
+{
+    boost::archive::binary_iarchive ia(is);
+    ia >> *this;
+}
+
+float HNSWIndex::similarity(const float* q, int i) const
+{
+    return simd_dot(q, point(i), D);
+}
+
+int HNSWIndex::greedy_search(const float* q, int entry, int from, int to) const
+{
+    // At each level, move to the most similar neighbor until none is better
+    int best = entry;
+    float bestSim = similarity(q, best);
+    for (int level = from;  level > to;  --level) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (int n : links[best][level]) {
+                const float s = similarity(q, n);
+                if (s > bestSim) {
+                    best = n;
+                    bestSim = s;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+std::vector<HNSWIndex::Candidate> HNSWIndex::search_level(const float* q, int entry, int ef, int level) const
+{
+    std::unordered_set<int> visited;
+    visited.insert(entry);
+    // `candidates` pops the most similar point first, `results` the least
+    // similar one, so that it keeps the `ef` most similar points seen so far
+    std::priority_queue<Candidate> candidates;
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<>> results;
+    const Candidate first(similarity(q, entry), entry);
+    candidates.push(first);
+    results.push(first);
+    while (!candidates.empty()) {
+        const Candidate c = candidates.top();
+        if (results.size() >= ef && c.first < results.top().first)
+            break;  // all the remaining candidates are worse than the results
+        candidates.pop();
+        for (int n : links[c.second][level]) {
+            if (!visited.insert(n).second)
+                continue;
+            const float s = similarity(q, n);
+            if (results.size() < ef || s > results.top().first) {
+                candidates.push(Candidate(s, n));
+                results.push(Candidate(s, n));
+                if (results.size() > ef)
+                    results.pop();
+            }
+        }
+    }
+    std::vector<Candidate> ret;
+    ret.reserve(results.size());
+    for (;  !results.empty();  results.pop())
+        ret.push_back(results.top());
+    std::reverse(ret.begin(), ret.end());
+    return ret;
+}
+
+std::vector<int> HNSWIndex::select_neighbors(const std::vector<Candidate>& candidates, int n) const
+{
+    // Keep a candidate only if it is more similar to the query than to all
+    // the candidates kept so far, which spreads the links in all directions
+    // instead of clustering them (the heuristic of the paper).
+    // Pre-condition: `candidates` is sorted descending
+    std::vector<int> ret;
+    for (const Candidate& c : candidates) {
+        if (ret.size() >= n)
+            break;
+        bool keep = true;
+        for (int r : ret) {
+            if (similarity(point(c.second), r) > c.first) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep)
+            ret.push_back(c.second);
+    }
+    return ret;
+}
+
+void HNSWIndex::insert(int i, int level)
+{
+    links[i].resize(level + 1);
+    if (entry == -1) {
+        entry = i;
+        maxLevel = level;
+        return;
+    }
+    const float* q = point(i);
+    int ep = greedy_search(q, entry, maxLevel, level);
+    for (int l = std::min(level, maxLevel);  l >= 0;  --l) {
+        const std::vector<Candidate> candidates = search_level(q, ep, efConstruction, l);
+        const int maxLinks = l == 0 ? 2 * M : M;
+        links[i][l] = select_neighbors(candidates, M);
+        for (int n : links[i][l]) {
+            std::vector<int>& nlinks = links[n][l];
+            nlinks.push_back(i);
+            if (nlinks.size() > maxLinks) {
+                // Too many links: re-select the neighbors of `n`
+                std::vector<Candidate> ncandidates;
+                for (int m : nlinks)
+                    ncandidates.push_back(Candidate(similarity(point(n), m), m));
+                std::sort(ncandidates.begin(), ncandidates.end(), std::greater<>());
+                nlinks = select_neighbors(ncandidates, maxLinks);
+            }
+        }
+        ep = candidates[0].second;
+    }
+    if (level > maxLevel) {
+        entry = i;
+        maxLevel = level;
+    }
+}
+
+std::vector<std::pair<double, int>> HNSWIndex::search_normalized(const float* q, int k, int ef, int exclude) const
+{
+    if (entry == -1)
+        return {};
+    const int ep = greedy_search(q, entry, maxLevel, 0);
+    const int n = k + (exclude >= 0 ? 1 : 0);
+    const std::vector<Candidate> candidates = search_level(q, ep, std::max(ef, n), 0);
+    std::vector<std::pair<double, int>> ret;
+    for (const Candidate& c : candidates) {
+        if (ret.size() >= k)
+            break;
+        if (c.second != exclude)
+            ret.push_back(std::make_pair(c.first, c.second));
+    }
+    return ret;
+}
+
+std::vector<std::pair<double, int>> HNSWIndex::search(const ublas::vector<double>& query, int k, int ef) const
+{
+    std::vector<float> q(D);
+    normalize_into(&query[0], D, q.data());
+    return search_normalized(q.data(), k, ef, -1);
+}
+
+std::vector<std::pair<double, int>> HNSWIndex::search(int point, int k, int ef) const
+{
+    return search_normalized(this->point(point), k, ef, point);
+}
+
+} // namespace toynet
@@ -0,0 +1,99 @@
+#include <toynet/w2v.h>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace toynet {
+
+// An approximate nearest neighbor index for cosine similarity, using
+// Hierarchical Navigable Small World graphs (https://arxiv.org/abs/1603.09320).
+// Each point is a node of a proximity graph at level 0, and of sparser graphs
+// at levels 1 ... l, where l is drawn from an exponential distribution.  A
+// query walks greedily down the upper levels to find a good entry point, then
+// runs a best-first search at level 0, visiting O(log(N)) nodes instead of
+// all N points.
+// Parameters trading recall for speed:
+// - M: the number of links per node at levels >= 1 (2 * M at level 0); larger
+//   values give better recall, but more memory and slower builds and queries
+// - efConstruction: the number of candidates kept while inserting a point;
+//   larger values give a better graph, but slower builds
+// - ef (per query): the number of candidates kept while searching; larger
+//   values give better recall, but slower queries
+struct HNSWIndex {
+    HNSWIndex() : D(0), M(0), efConstruction(0), entry(-1), maxLevel(-1) {}
+
+    // Build an index over the rows of `points`, e.g. `CBOWModel::P`.
+    // Point `i` of the index is row `i` of `points`.
+    // Pre-conditions:
+    //   - M >= 2
+    //   - efConstruction >= 1
+    explicit HNSWIndex(const BasicEmbeddingMatrix<double>& points, int M=16, int efConstruction=200, unsigned int seed=0);
+
+    explicit HNSWIndex(const BasicEmbeddingMatrix<float>& points, int M=16, int efConstruction=200, unsigned int seed=0);
+
+    // The number of points
+    int size() const { return links.size(); }
+
+    // Save the index to an output stream using a Boost binary archive: the
+    // points are written as raw floats, in native byte order, so the file can
+    // only be loaded on a platform with the same byte order and type sizes.
+    // File streams must be opened with std::ios::binary.
+    void save(std::ostream& os) const;
+
+    // Load an index saved with `save` from an input stream
+    // Throws boost::archive::archive_exception if the stream is not a valid
+    // index.
+    void load(std::istream& is);
+
+    // The (approximately) `k` most similar points to `query`, as (cosine
+    // similarity, point index) pairs sorted descending
+    // Pre-conditions:
+    //   - query.size() == D
+    //   - k >= 0
+    std::vector<std::pair<double, int>> search(const ublas::vector<double>& query, int k, int ef=50) const;
+
+    // Like the previous `search` function, but for the query point `point`
+    // of the index, which is excluded from the results
+    // Pre-conditions: 0 <= point < size()
+    std::vector<std::pair<double, int>> search(int point, int k, int ef=50) const;
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & D;
+        ar & M;
+        ar & efConstruction;
+        ar & entry;
+        ar & maxLevel;
+        ar & vectors;
+        ar & links;
+    }
+
+    typedef std::pair<float, int> Candidate;  // (similarity, point)
+
+    // Helper functions for building and searching the graphs
+    const float* point(int i) const { return &vectors[std::size_t(i) * D]; }
+    float similarity(const float* q, int i) const;
+    void insert(int i, int level);
+    int greedy_search(const float* q, int entry, int from, int to) const;
+    std::vector<Candidate> search_level(const float* q, int entry, int ef, int level) const;
+    std::vector<int> select_neighbors(const std::vector<Candidate>& candidates, int n) const;
+    std::vector<std::pair<double, int>> search_normalized(const float* q, int k, int ef, int exclude) const;
+
+    int D;
+    int M;
+    int efConstruction;
+    // The point where all the searches start, at level `maxLevel`; -1 if empty
+    int entry;
+    int maxLevel;
+    // The points, normalized to unit length, in row-major order
+    std::vector<float> vectors;
+    // links[i][l] are the neighbors of point `i` at level `l`
+    std::vector<std::vector<std::vector<int>>> links;
+};
+
+} // namespace toynet
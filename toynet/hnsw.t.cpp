@@ -0,0 +1,112 @@
+#include <toynet/hnsw.h>
+#include <toynet/stlio.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/numeric/ublas/matrix_proxy.hpp>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <set>
+#include <sstream>
+
+using namespace toynet;
+
+EmbeddingMatrix random_points(int N, int D, unsigned int seed)
+{
+    EmbeddingMatrix ret(N, D);
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> dist;
+    for (double& x : ret.data())
+        x = dist(rng);
+    return ret;
+}
+
+// The indices of the `k` rows of `points` most similar to `query`
+std::vector<int> brute_force(const EmbeddingMatrix& points, const ublas::vector<double>& query, int k)
+{
+    std::vector<std::pair<double, int>> all;
+    for (int i = 0;  i < points.size1();  ++i) {
+        const ublas::vector<double> p = ublas::row(points, i);
+        all.push_back(std::make_pair(inner_prod(p, query) / norm_2(p) / norm_2(query), i));
+    }
+    std::sort(all.begin(), all.end(), std::greater<>());
+    std::vector<int> ret;
+    for (int i = 0;  i < k;  ++i)
+        ret.push_back(all[i].second);
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(HNSWIndex_empty)
+{
+    const HNSWIndex index(EmbeddingMatrix(0, 3));
+    BOOST_CHECK_EQUAL(0, index.size());
+    BOOST_CHECK(index.search(ublas::vector<double>(3, 1.0), 5).empty());
+}
+
+BOOST_AUTO_TEST_CASE(HNSWIndex_small_exact)
+{
+    // With fewer points than `ef`, the search is exhaustive
+    const EmbeddingMatrix points = random_points(10, 4, 0);
+    const HNSWIndex index(points, 4, 20);
+    BOOST_CHECK_EQUAL(10, index.size());
+    const ublas::vector<double> query = ublas::row(points, 3);
+    const auto got = index.search(query, 10);
+    const std::vector<int> expected = brute_force(points, query, 10);
+    BOOST_REQUIRE_EQUAL(10, got.size());
+    for (int i = 0;  i < 10;  ++i)
+        BOOST_CHECK_EQUAL(expected[i], got[i].second);
+    BOOST_CHECK_CLOSE(1.0, got[0].first, 1e-4);
+    // searching for an indexed point excludes it
+    const auto neighbors = index.search(3, 3);
+    BOOST_REQUIRE_EQUAL(3, neighbors.size());
+    for (int i = 0;  i < 3;  ++i)
+        BOOST_CHECK_EQUAL(expected[i+1], neighbors[i].second);
+    // single precision points
+    BasicEmbeddingMatrix<float> fpoints(10, 4);
+    std::copy(points.data().begin(), points.data().end(), fpoints.data().begin());
+    const HNSWIndex findex(fpoints, 4, 20);
+    const auto fgot = findex.search(query, 10);
+    BOOST_REQUIRE_EQUAL(10, fgot.size());
+    for (int i = 0;  i < 10;  ++i)
+        BOOST_CHECK_EQUAL(expected[i], fgot[i].second);
+}
+
+BOOST_AUTO_TEST_CASE(HNSWIndex_recall)
+{
+    const EmbeddingMatrix points = random_points(2000, 16, 1);
+    const HNSWIndex index(points, 8, 100);
+    const EmbeddingMatrix queries = random_points(50, 16, 2);
+    int found = 0;
+    for (int q = 0;  q < queries.size1();  ++q) {
+        const ublas::vector<double> query = ublas::row(queries, q);
+        const std::vector<int> expected = brute_force(points, query, 10);
+        const auto got = index.search(query, 10, 100);
+        BOOST_REQUIRE_EQUAL(10, got.size());
+        std::set<int> ids;
+        for (int i = 0;  i < got.size();  ++i) {
+            ids.insert(got[i].second);
+            if (i > 0)
+                BOOST_CHECK(got[i-1].first >= got[i].first);
+        }
+        for (int i : expected)
+            found += ids.count(i);
+    }
+    BOOST_CHECK(found >= 0.95 * 10 * queries.size1());
+}
+
+BOOST_AUTO_TEST_CASE(HNSWIndex_save_load)
+{
+    const EmbeddingMatrix points = random_points(50, 5, 3);
+    const HNSWIndex expected(points, 4, 16);
+    std::stringstream ss;
+    expected.save(ss);
+    HNSWIndex got;
+    got.load(ss);
+    BOOST_CHECK_EQUAL(expected.size(), got.size());
+    BOOST_CHECK_EQUAL(expected.entry, got.entry);
+    BOOST_CHECK_EQUAL(expected.maxLevel, got.maxLevel);
+    BOOST_CHECK(expected.vectors == got.vectors);
+    for (int i = 0;  i < 50;  i += 7)
+        BOOST_CHECK_EQUAL(expected.search(i, 5), got.search(i, 5));
+    std::stringstream not_an_index("not an index");
+    BOOST_CHECK_THROW(got.load(not_an_index), std::exception);
+}
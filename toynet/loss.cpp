@@ -53,20 +53,26 @@ std::pair<double, ublas::vector<double>> MSELoss::operator()(
     return std::make_pair(loss, gradients);
 }
 
+SoftmaxLoss::SoftmaxLoss()
+    : accuracy(ExpAccuracy::exact)
+{
+}
+
 std::pair<double, ublas::vector<double>> SoftmaxLoss::operator()(
     const ublas::vector<double>& y, const ublas::vector<double>& y_hat) const
 {
     // See loss.md for explanations
-    ublas::vector<double> soft = softmax(y_hat);
+    ublas::vector<double> g(y_hat.size());
+    const double lse = softmax_into(g, y_hat, accuracy);
     // Find the index of the only element of `y` with non-zero value
     int i = 0;
     for ( ;  i < y.size();  ++i)
         if (y[i] > 0.5)
             break;
-    // Compute the loss
-    double loss = -std::log(soft[i]);
+    // Compute the loss, -log(softmax(y_hat)[i]), from the logits so that it
+    // stays finite when g[i] underflows
+    double loss = lse - y_hat[i];
     // Compute the gradient of the loss w.r.t. y_hat
-    ublas::vector<double> g = soft;
     g[i] -= 1.0;
     return std::make_pair(loss, g);
 }
@@ -3,6 +3,9 @@
 
 namespace toynet {
 
+// See math.h
+enum class ExpAccuracy;
+
 struct Loss {
     // Compute the loss and gradient for a single output
     virtual std::pair<double, double> operator()(
@@ -29,10 +32,17 @@ struct MSELoss : public Loss {
 
 // Cross-entropy over softmax output
 struct SoftmaxLoss : public Loss {
+    SoftmaxLoss();
+
+    // `accuracy` is the accuracy of exp in the softmax, see `ExpAccuracy`
+    explicit SoftmaxLoss(ExpAccuracy accuracy) : accuracy(accuracy) {}
+
     // Pre-condition: there exists one j such that y[j] == 1 and y[i] == 0 for all i != j
     virtual std::pair<double, ublas::vector<double>> operator()(
         const ublas::vector<double>& y, const ublas::vector<double>& y_hat) const override;
     virtual std::string name() const override {return "SoftmaxLoss";}
+
+    ExpAccuracy accuracy;
 };
 
 } // namespace toynet
@@ -1,4 +1,5 @@
 #include <toynet/loss.h>
+#include <toynet/math.h>
 #include <toynet/ublas/convert.h>
 #include <toynet/ublas/test.h>
 #include <boost/test/unit_test.hpp>
@@ -58,3 +59,26 @@ BOOST_AUTO_TEST_CASE(softmax_loss_3)
     BOOST_CHECK_CLOSE(2.1791041747850026, res.first, 1e-6);
     check_close_vectors(convert({0.8360188, -1.0+0.11314284, 0.05083836}), res.second, 1e-5);
 }
+
+BOOST_AUTO_TEST_CASE(softmax_loss_spread_logits)
+{
+    // softmax(y_hat)[1] underflows to 0, but the loss is finite
+    SoftmaxLoss loss;
+    const ublas::vector<double> y = convert({0.0, 1.0, 0.0});
+    const ublas::vector<double> y_hat = convert({1000.0, 0.0, 0.0});
+    auto res = loss(y, y_hat);
+    BOOST_CHECK_CLOSE(1000.0, res.first, 1e-10);
+    check_close_vectors(convert({1.0, -1.0, 0.0}), res.second);
+}
+
+BOOST_AUTO_TEST_CASE(softmax_loss_fast_exp)
+{
+    const ublas::vector<double> y = convert({0.0, 1.0, 0.0});
+    const ublas::vector<double> y_hat = convert({3.0, 1.0, 0.2});
+    const auto exact = SoftmaxLoss()(y, y_hat);
+    for (ExpAccuracy accuracy : {ExpAccuracy::high, ExpAccuracy::low}) {
+        const auto res = SoftmaxLoss(accuracy)(y, y_hat);
+        BOOST_CHECK_CLOSE(exact.first, res.first, 1e-2);
+        check_close_vectors(exact.second, res.second, 1e-2);
+    }
+}
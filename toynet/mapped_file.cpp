@@ -0,0 +1,75 @@
+#include <toynet/mapped_file.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace toynet {
+
+MappedFile::MappedFile(const std::string& path)
+    : data(nullptr)
+    , size(0)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("MappedFile: cannot open " + path + ": " + std::strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int err = errno;
+        close(fd);
+        throw std::runtime_error("MappedFile: cannot stat " + path + ": " + std::strerror(err));
+    }
+    size = st.st_size;
+    if (size > 0) {
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error("MappedFile: cannot map " + path + ": " + std::strerror(err));
+        }
+        data = static_cast<char*>(addr);
+    }
+    // The mapping stays valid after the file is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        munmap(data, size);
+}
+
+SharedMemory::SharedMemory(std::size_t size)
+    : data(nullptr)
+    , size(size)
+{
+    static std::atomic<int> counter(0);
+    const std::string name = "/toynet-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        throw std::runtime_error("SharedMemory: cannot create " + name + ": " + std::strerror(errno));
+    shm_unlink(name.c_str());
+    if (ftruncate(fd, size) != 0) {
+        const int err = errno;
+        close(fd);
+        throw std::runtime_error("SharedMemory: cannot resize " + name + ": " + std::strerror(err));
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int err = errno;
+    close(fd);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error("SharedMemory: cannot map " + name + ": " + std::strerror(err));
+    data = static_cast<char*>(addr);
+}
+
+SharedMemory::~SharedMemory()
+{
+    if (data)
+        munmap(data, size);
+}
+
+} // namespace toynet
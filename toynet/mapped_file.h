@@ -0,0 +1,43 @@
+#include <cstddef>
+#include <string>
+
+namespace toynet {
+
+// A private memory mapping of a whole file.
+// The mapping is readable and writable, but it is copy-on-write: the pages
+// are shared with the page cache until they are modified, and modifications
+// are never written back to the file.
+struct MappedFile {
+    // Map the file at `path`.
+    // Throws std::runtime_error if the file cannot be opened or mapped.
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    char* data;
+    std::size_t size;
+};
+
+// An anonymous POSIX shared-memory segment (shm_open) of `size` bytes,
+// filled with zeros.  The segment is shared with the child processes
+// created by fork() after its construction.  Its name is unlinked as soon as
+// it is mapped, so the memory is released when the last process unmaps it,
+// even if the processes are killed.
+struct SharedMemory {
+    // Throws std::runtime_error if the segment cannot be created or mapped.
+    // Pre-conditions: size > 0
+    explicit SharedMemory(std::size_t size);
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    ~SharedMemory();
+
+    char* data;
+    std::size_t size;
+};
+
+} // namespace toynet
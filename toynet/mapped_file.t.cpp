@@ -0,0 +1,64 @@
+#include <toynet/mapped_file.h>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+BOOST_AUTO_TEST_CASE(MappedFile_read)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_MappedFile_read").string();
+    {
+        std::ofstream os(path, std::ios::binary);
+        os << "hello";
+    }
+    {
+        MappedFile file(path);
+        BOOST_REQUIRE_EQUAL(5, file.size);
+        BOOST_CHECK_EQUAL("hello", std::string(file.data, file.size));
+        // copy-on-write: the file is not modified
+        file.data[0] = 'j';
+        BOOST_CHECK_EQUAL("jello", std::string(file.data, file.size));
+    }
+    {
+        MappedFile file(path);
+        BOOST_CHECK_EQUAL("hello", std::string(file.data, file.size));
+    }
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(MappedFile_empty)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_MappedFile_empty").string();
+    std::ofstream(path, std::ios::binary).close();
+    MappedFile file(path);
+    BOOST_CHECK_EQUAL(0, file.size);
+    BOOST_CHECK(file.data == nullptr);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(MappedFile_missing)
+{
+    BOOST_CHECK_THROW(MappedFile("/nonexistent/toynet"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(SharedMemory_fork)
+{
+    SharedMemory shm(4096);
+    BOOST_REQUIRE_EQUAL(4096, shm.size);
+    BOOST_CHECK_EQUAL(0, shm.data[4095]);
+    const pid_t pid = fork();
+    BOOST_REQUIRE(pid >= 0);
+    if (pid == 0) {
+        std::strcpy(shm.data, "child");
+        _exit(0);
+    }
+    int status = 0;
+    BOOST_REQUIRE_EQUAL(pid, waitpid(pid, &status, 0));
+    BOOST_CHECK_EQUAL("child", std::string(shm.data));
+}
@@ -1,14 +1,498 @@
 #include <toynet/math.h>
+#include <toynet/blas.h>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <limits>
+#include <thread>
 #include <boost/numeric/ublas/matrix_proxy.hpp>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace toynet {
 
+namespace {
+
+// Portable versions of the SIMD kernels, also used for the tails of the
+// vectorized loops
+template<class T>
+T dot_scalar(const T* a, const T* b, int n)
+{
+    T ret = 0;
+    for (int i = 0;  i < n;  ++i)
+        ret += a[i] * b[i];
+    return ret;
+}
+
+double max_scalar(const double* x, int n)
+{
+    return *std::max_element(x, x + n);
+}
+
+void scale_scalar(double* x, int n, double a)
+{
+    for (int i = 0;  i < n;  ++i)
+        x[i] *= a;
+}
+
+// Polynomial approximation of exp: exp(x) = 2^k * exp(r), where k is the
+// integer nearest to x / ln(2) and r = x - k * ln(2), so that |r| <= ln(2) / 2.
+// exp(r) is the Taylor polynomial of degree `degree`, and 2^k is built
+// directly in the exponent bits: adding 1.5 * 2^52 to x / ln(2) rounds it
+// and leaves k in the low bits of the mantissa.  ln(2) is split in two
+// constants (Cody-Waite) so that r is exact.  Inputs below exp_min give 0
+// and inputs above exp_max are clamped, which keeps 2^k a normal double.
+const double exp_min = -708.0;
+const double exp_max = 709.0;
+const double exp_log2e = 1.4426950408889634;
+const double exp_ln2_hi = 6.93147180369123816490e-01;
+const double exp_ln2_lo = 1.90821492927058770002e-10;
+const double exp_shifter = 6755399441055744.0;
+// 1 / j!
+const double exp_coefs[] = {
+    1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040,
+    1.0 / 40320, 1.0 / 362880,
+};
+
+// The degree of the polynomial of each accuracy
+int exp_degree(ExpAccuracy accuracy)
+{
+    return accuracy == ExpAccuracy::high ? 7 : 4;
+}
+
+double exp_poly(double x, int degree)
+{
+    if (x < exp_min)
+        return 0.0;
+    x = std::min(x, exp_max);
+    double kd = x * exp_log2e + exp_shifter;
+    std::uint64_t bits;
+    std::memcpy(&bits, &kd, sizeof(bits));
+    kd -= exp_shifter;
+    const double r = (x - kd * exp_ln2_hi) - kd * exp_ln2_lo;
+    double p = exp_coefs[degree];
+    for (int j = degree - 1;  j >= 0;  --j)
+        p = p * r + exp_coefs[j];
+    bits = (bits + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// The exp kernels compute out[i] = exp(x[i] - shift) with a polynomial of
+// degree `degree` and return the sum of the results.  `out` may be `x`, or
+// nullptr when only the sum is needed.
+double exp_scalar(double* out, const double* x, int n, double shift, int degree)
+{
+    double sum = 0;
+    for (int i = 0;  i < n;  ++i) {
+        const double e = exp_poly(x[i] - shift, degree);
+        if (out)
+            out[i] = e;
+        sum += e;
+    }
+    return sum;
+}
+
+#if defined(__x86_64__)
+
+// Each loop uses two accumulators to hide the latency of the additions
+
+__attribute__((target("sse2")))
+double dot_sse2(const double* a, const double* b, int n)
+{
+    __m128d s0 = _mm_setzero_pd();
+    __m128d s1 = _mm_setzero_pd();
+    int i = 0;
+    for (;  i + 4 <= n;  i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double s[2];
+    _mm_storeu_pd(s, _mm_add_pd(s0, s1));
+    return s[0] + s[1] + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+float dot_sse2(const float* a, const float* b, int n)
+{
+    __m128 s0 = _mm_setzero_ps();
+    __m128 s1 = _mm_setzero_ps();
+    int i = 0;
+    for (;  i + 8 <= n;  i += 8) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float s[4];
+    _mm_storeu_ps(s, _mm_add_ps(s0, s1));
+    return (s[0] + s[1]) + (s[2] + s[3]) + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+double max_sse2(const double* x, int n)
+{
+    if (n < 2)
+        return max_scalar(x, n);
+    __m128d m = _mm_loadu_pd(x);
+    int i = 2;
+    for (;  i + 2 <= n;  i += 2)
+        m = _mm_max_pd(m, _mm_loadu_pd(x + i));
+    double s[2];
+    _mm_storeu_pd(s, m);
+    double ret = std::max(s[0], s[1]);
+    for (;  i < n;  ++i)
+        ret = std::max(ret, x[i]);
+    return ret;
+}
+
+__attribute__((target("sse2")))
+void scale_sse2(double* x, int n, double a)
+{
+    const __m128d f = _mm_set1_pd(a);
+    int i = 0;
+    for (;  i + 2 <= n;  i += 2)
+        _mm_storeu_pd(x + i, _mm_mul_pd(_mm_loadu_pd(x + i), f));
+    scale_scalar(x + i, n - i, a);
+}
+
+__attribute__((target("sse2")))
+double exp_sse2(double* out, const double* x, int n, double shift, int degree)
+{
+    const __m128d s = _mm_set1_pd(shift);
+    const __m128d lo = _mm_set1_pd(exp_min);
+    const __m128d hi = _mm_set1_pd(exp_max);
+    const __m128d shifter = _mm_set1_pd(exp_shifter);
+    __m128d sum = _mm_setzero_pd();
+    int i = 0;
+    for (;  i + 2 <= n;  i += 2) {
+        __m128d v = _mm_sub_pd(_mm_loadu_pd(x + i), s);
+        const __m128d zero = _mm_cmplt_pd(v, lo);
+        v = _mm_max_pd(_mm_min_pd(v, hi), lo);
+        __m128d kd = _mm_add_pd(_mm_mul_pd(v, _mm_set1_pd(exp_log2e)), shifter);
+        const __m128i bits = _mm_castpd_si128(kd);
+        kd = _mm_sub_pd(kd, shifter);
+        __m128d r = _mm_sub_pd(v, _mm_mul_pd(kd, _mm_set1_pd(exp_ln2_hi)));
+        r = _mm_sub_pd(r, _mm_mul_pd(kd, _mm_set1_pd(exp_ln2_lo)));
+        __m128d p = _mm_set1_pd(exp_coefs[degree]);
+        for (int j = degree - 1;  j >= 0;  --j)
+            p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(exp_coefs[j]));
+        const __m128i scale = _mm_slli_epi64(_mm_add_epi64(bits, _mm_set1_epi64x(1023)), 52);
+        const __m128d e = _mm_andnot_pd(zero, _mm_mul_pd(p, _mm_castsi128_pd(scale)));
+        if (out)
+            _mm_storeu_pd(out + i, e);
+        sum = _mm_add_pd(sum, e);
+    }
+    double t[2];
+    _mm_storeu_pd(t, sum);
+    return t[0] + t[1] + exp_scalar(out ? out + i : nullptr, x + i, n - i, shift, degree);
+}
+
+__attribute__((target("avx2,fma")))
+double dot_avx2(const double* a, const double* b, int n)
+{
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (;  i + 8 <= n;  i += 8) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), s1);
+    }
+    double s[4];
+    _mm256_storeu_pd(s, _mm256_add_pd(s0, s1));
+    return (s[0] + s[1]) + (s[2] + s[3]) + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+float dot_avx2(const float* a, const float* b, int n)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (;  i + 16 <= n;  i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    float s[8];
+    _mm256_storeu_ps(s, _mm256_add_ps(s0, s1));
+    float ret = 0;
+    for (float x : s)
+        ret += x;
+    return ret + dot_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+double max_avx2(const double* x, int n)
+{
+    if (n < 4)
+        return max_scalar(x, n);
+    __m256d m = _mm256_loadu_pd(x);
+    int i = 4;
+    for (;  i + 4 <= n;  i += 4)
+        m = _mm256_max_pd(m, _mm256_loadu_pd(x + i));
+    double s[4];
+    _mm256_storeu_pd(s, m);
+    double ret = *std::max_element(s, s + 4);
+    for (;  i < n;  ++i)
+        ret = std::max(ret, x[i]);
+    return ret;
+}
+
+__attribute__((target("avx2")))
+void scale_avx2(double* x, int n, double a)
+{
+    const __m256d f = _mm256_set1_pd(a);
+    int i = 0;
+    for (;  i + 4 <= n;  i += 4)
+        _mm256_storeu_pd(x + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), f));
+    scale_scalar(x + i, n - i, a);
+}
+
+__attribute__((target("avx2,fma")))
+double exp_avx2(double* out, const double* x, int n, double shift, int degree)
+{
+    const __m256d s = _mm256_set1_pd(shift);
+    const __m256d lo = _mm256_set1_pd(exp_min);
+    const __m256d hi = _mm256_set1_pd(exp_max);
+    const __m256d shifter = _mm256_set1_pd(exp_shifter);
+    __m256d sum = _mm256_setzero_pd();
+    int i = 0;
+    for (;  i + 4 <= n;  i += 4) {
+        __m256d v = _mm256_sub_pd(_mm256_loadu_pd(x + i), s);
+        const __m256d zero = _mm256_cmp_pd(v, lo, _CMP_LT_OQ);
+        v = _mm256_max_pd(_mm256_min_pd(v, hi), lo);
+        __m256d kd = _mm256_fmadd_pd(v, _mm256_set1_pd(exp_log2e), shifter);
+        const __m256i bits = _mm256_castpd_si256(kd);
+        kd = _mm256_sub_pd(kd, shifter);
+        __m256d r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(exp_ln2_hi), v);
+        r = _mm256_fnmadd_pd(kd, _mm256_set1_pd(exp_ln2_lo), r);
+        __m256d p = _mm256_set1_pd(exp_coefs[degree]);
+        for (int j = degree - 1;  j >= 0;  --j)
+            p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(exp_coefs[j]));
+        const __m256i scale = _mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52);
+        const __m256d e = _mm256_andnot_pd(zero, _mm256_mul_pd(p, _mm256_castsi256_pd(scale)));
+        if (out)
+            _mm256_storeu_pd(out + i, e);
+        sum = _mm256_add_pd(sum, e);
+    }
+    double t[4];
+    _mm256_storeu_pd(t, sum);
+    return (t[0] + t[1]) + (t[2] + t[3]) + exp_scalar(out ? out + i : nullptr, x + i, n - i, shift, degree);
+}
+
+// The AVX-512 kernels handle the tails with masked loads instead of scalar
+// loops
+
+__attribute__((target("avx512f")))
+double dot_avx512(const double* a, const double* b, int n)
+{
+    __m512d s0 = _mm512_setzero_pd();
+    __m512d s1 = _mm512_setzero_pd();
+    int i = 0;
+    for (;  i + 16 <= n;  i += 16) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), s0);
+        s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), s1);
+    }
+    for (;  i < n;  i += 8) {
+        const __mmask8 mask = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), s0);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+__attribute__((target("avx512f")))
+float dot_avx512(const float* a, const float* b, int n)
+{
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    int i = 0;
+    for (;  i + 32 <= n;  i += 32) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    }
+    for (;  i < n;  i += 16) {
+        const __mmask16 mask = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), s0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+
+__attribute__((target("avx512f")))
+double max_avx512(const double* x, int n)
+{
+    if (n < 8)
+        return max_scalar(x, n);
+    __m512d m = _mm512_loadu_pd(x);
+    int i = 8;
+    for (;  i + 8 <= n;  i += 8)
+        m = _mm512_max_pd(m, _mm512_loadu_pd(x + i));
+    // The last 8 elements overlap the previous ones, which is harmless for
+    // a maximum
+    if (i < n)
+        m = _mm512_max_pd(m, _mm512_loadu_pd(x + n - 8));
+    return _mm512_reduce_max_pd(m);
+}
+
+__attribute__((target("avx512f")))
+void scale_avx512(double* x, int n, double a)
+{
+    const __m512d f = _mm512_set1_pd(a);
+    for (int i = 0;  i < n;  i += 8) {
+        const __mmask8 mask = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        _mm512_mask_storeu_pd(x + i, mask, _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, x + i), f));
+    }
+}
+
+__attribute__((target("avx512f")))
+double exp_avx512(double* out, const double* x, int n, double shift, int degree)
+{
+    const __m512d s = _mm512_set1_pd(shift);
+    const __m512d lo = _mm512_set1_pd(exp_min);
+    const __m512d hi = _mm512_set1_pd(exp_max);
+    const __m512d shifter = _mm512_set1_pd(exp_shifter);
+    __m512d sum = _mm512_setzero_pd();
+    for (int i = 0;  i < n;  i += 8) {
+        const __mmask8 mask = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        __m512d v = _mm512_sub_pd(_mm512_maskz_loadu_pd(mask, x + i), s);
+        const __mmask8 keep = mask & _mm512_cmp_pd_mask(v, lo, _CMP_GE_OQ);
+        v = _mm512_max_pd(_mm512_min_pd(v, hi), lo);
+        __m512d kd = _mm512_fmadd_pd(v, _mm512_set1_pd(exp_log2e), shifter);
+        const __m512i bits = _mm512_castpd_si512(kd);
+        kd = _mm512_sub_pd(kd, shifter);
+        __m512d r = _mm512_fnmadd_pd(kd, _mm512_set1_pd(exp_ln2_hi), v);
+        r = _mm512_fnmadd_pd(kd, _mm512_set1_pd(exp_ln2_lo), r);
+        __m512d p = _mm512_set1_pd(exp_coefs[degree]);
+        for (int j = degree - 1;  j >= 0;  --j)
+            p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(exp_coefs[j]));
+        const __m512i scale = _mm512_slli_epi64(_mm512_add_epi64(bits, _mm512_set1_epi64(1023)), 52);
+        const __m512d e = _mm512_maskz_mul_pd(keep, p, _mm512_castsi512_pd(scale));
+        if (out)
+            _mm512_mask_storeu_pd(out + i, mask, e);
+        sum = _mm512_add_pd(sum, e);
+    }
+    return _mm512_reduce_add_pd(sum);
+}
+
+#endif
+
+SimdLevel detect_simd_level()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::avx2;
+    return SimdLevel::sse2;
+#else
+    return SimdLevel::scalar;
+#endif
+}
+
+// Call the implementation of a kernel for `level`
+#if defined(__x86_64__)
+#define SIMD_DISPATCH(level, kernel, ...) \
+    switch (level) { \
+      case SimdLevel::avx512: return kernel##_avx512(__VA_ARGS__); \
+      case SimdLevel::avx2: return kernel##_avx2(__VA_ARGS__); \
+      case SimdLevel::sse2: return kernel##_sse2(__VA_ARGS__); \
+      default: return kernel##_scalar(__VA_ARGS__); \
+    }
+#else
+#define SIMD_DISPATCH(level, kernel, ...) return kernel##_scalar(__VA_ARGS__);
+#endif
+
+
+template<class T>
+void softmax_rows_impl(ublas::matrix<T>& m)
+{
+    for (int i = 0;  i < m.size1();  ++i) {
+        ublas::matrix_row<ublas::matrix<T>> r(m, i);
+        T max = r.size() == 0 ? T(0) : *std::max_element(r.begin(), r.end());
+        T sum = 0;
+        for (auto& x : r) {
+            x = std::exp(x - max);
+            sum += x;
+        }
+        r /= sum;
+    }
+}
+
+template<class T>
+ublas::matrix<T> prod_trans_impl(const ublas::matrix<T>& a, const ublas::matrix<T>& b)
+{
+    ublas::matrix<T> ret(a.size1(), b.size1());
+    if (ret.size1() > 0 && ret.size2() > 0)
+        prod_trans(a.data().begin(), b.data().begin(), ret.data().begin(), a.size1(), b.size1(), a.size2());
+    return ret;
+}
+
+} // namespace
+
+SimdLevel simd_level()
+{
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+const char* simd_level_name(SimdLevel level)
+{
+    switch (level) {
+      case SimdLevel::sse2: return "sse2";
+      case SimdLevel::avx2: return "avx2";
+      case SimdLevel::avx512: return "avx512";
+      default: return "scalar";
+    }
+}
+
+double simd_dot(const double* a, const double* b, int n, SimdLevel level)
+{
+    SIMD_DISPATCH(level, dot, a, b, n)
+}
+
+float simd_dot(const float* a, const float* b, int n, SimdLevel level)
+{
+    SIMD_DISPATCH(level, dot, a, b, n)
+}
+
+double simd_max(const double* x, int n, SimdLevel level)
+{
+    SIMD_DISPATCH(level, max, x, n)
+}
+
+void simd_scale(double* x, int n, double a, SimdLevel level)
+{
+    SIMD_DISPATCH(level, scale, x, n, a)
+}
+
+double simd_exp(double* out, const double* x, int n, double shift, ExpAccuracy accuracy, SimdLevel level)
+{
+    if (accuracy == ExpAccuracy::exact) {
+        double sum = 0;
+        for (int i = 0;  i < n;  ++i) {
+            const double e = std::exp(x[i] - shift);
+            if (out)
+                out[i] = e;
+            sum += e;
+        }
+        return sum;
+    }
+    const int degree = exp_degree(accuracy);
+    SIMD_DISPATCH(level, exp, out, x, n, shift, degree)
+}
+
 ublas::vector<double> softmax(const ublas::vector<double>& v)
 {
-    return stable_softmax(v);
+    return simd_softmax(v);
+}
+
+ublas::vector<double> softmax(const ublas::vector<double>& v, ExpAccuracy accuracy)
+{
+    ublas::vector<double> ret(v.size());
+    softmax_into(ret, v, accuracy);
+    return ret;
 }
 
 ublas::vector<double> naive_softmax(const ublas::vector<double>& v)
@@ -34,9 +518,68 @@ ublas::vector<double> stable_softmax(const ublas::vector<double> &v)
     return ret;
 }
 
+ublas::vector<double> simd_softmax(const ublas::vector<double>& v)
+{
+    ublas::vector<double> ret(v.size());
+    softmax_into(ret, v);
+    return ret;
+}
+
+void softmax_rows(ublas::matrix<double>& m)
+{
+    softmax_rows_impl(m);
+}
+
+void softmax_rows(ublas::matrix<float>& m)
+{
+    softmax_rows_impl(m);
+}
+
+double softmax_into(double* out, const double* x, int n, ExpAccuracy accuracy)
+{
+    if (n == 0)
+        return -std::numeric_limits<double>::infinity();
+    const double max = simd_max(x, n);
+    const double sum = simd_exp(out, x, n, max, accuracy);
+    simd_scale(out, n, 1.0 / sum);
+    return max + std::log(sum);
+}
+
+double softmax_into(ublas::vector<double>& out, const ublas::vector<double>& v, ExpAccuracy accuracy)
+{
+    return softmax_into(out.data().begin(), v.data().begin(), v.size(), accuracy);
+}
+
+double logsumexp(const double* x, int n, ExpAccuracy accuracy)
+{
+    if (n == 0)
+        return -std::numeric_limits<double>::infinity();
+    const double max = simd_max(x, n);
+    return max + std::log(simd_exp(nullptr, x, n, max, accuracy));
+}
+
+double logsumexp(const ublas::vector<double>& v, ExpAccuracy accuracy)
+{
+    return logsumexp(v.data().begin(), v.size(), accuracy);
+}
+
+double log_softmax_at(const ublas::vector<double>& v, int i, ExpAccuracy accuracy)
+{
+    return v[i] - logsumexp(v, accuracy);
+}
+
+double sigmoid(double x)
+{
+    // avoid overflowing exp() for large |x|
+    if (x >= 0.0)
+        return 1.0 / (1.0 + exp(-x));
+    const double e = exp(x);
+    return e / (1.0 + e);
+}
+
 double magnitude(const ublas::vector<double>& v)
 {
-    return ublas_magnitude(v);
+    return simd_magnitude(v);
 }
 
 double naive_magnitude(const ublas::vector<double>& v)
@@ -52,9 +595,14 @@ double ublas_magnitude(const ublas::vector<double>& v)
     return ublas::norm_2(v);
 }
 
+double simd_magnitude(const ublas::vector<double>& v)
+{
+    return v.empty() ? 0.0 : sqrt(simd_dot(&v[0], &v[0], v.size()));
+}
+
 double dot_product(const ublas::vector<double>& v1, const ublas::vector<double>& v2)
 {
-    return ublas_dot_product(v1, v2);
+    return simd_dot_product(v1, v2);
 }
 
 double naive_dot_product(const ublas::vector<double>& v1, const ublas::vector<double>& v2)
@@ -70,6 +618,54 @@ double ublas_dot_product(const ublas::vector<double>& v1, const ublas::vector<do
     return ublas::inner_prod(v1, v2);
 }
 
+double simd_dot_product(const ublas::vector<double>& v1, const ublas::vector<double>& v2)
+{
+    return v1.empty() ? 0.0 : simd_dot(&v1[0], &v2[0], v1.size());
+}
+
+ublas::matrix<double> prod_trans(const ublas::matrix<double>& a, const ublas::matrix<double>& b)
+{
+    return prod_trans_impl(a, b);
+}
+
+ublas::matrix<double> naive_prod_trans(const ublas::matrix<double>& a, const ublas::matrix<double>& b)
+{
+    ublas::matrix<double> ret(a.size1(), b.size1());
+    for (int i = 0;  i < a.size1();  ++i) {
+        for (int j = 0;  j < b.size1();  ++j) {
+            double sum = 0.0;
+            for (int k = 0;  k < a.size2();  ++k)
+                sum += a(i, k) * b(j, k);
+            ret(i, j) = sum;
+        }
+    }
+    return ret;
+}
+
+ublas::matrix<double> ublas_prod_trans(const ublas::matrix<double>& a, const ublas::matrix<double>& b)
+{
+    return ublas::prod(a, ublas::trans(b));
+}
+
+ublas::matrix<float> prod_trans(const ublas::matrix<float>& a, const ublas::matrix<float>& b)
+{
+    return prod_trans_impl(a, b);
+}
+
+void prod_trans(const double* a, const double* b, double* c, int M, int N, int K)
+{
+    // CBLAS wants leading dimensions of at least 1
+    const int ld = std::max(1, K);
+    gemm(Trans::no, Trans::yes, M, N, K, 1.0, a, ld, b, ld, 0.0, c, std::max(1, N));
+}
+
+void prod_trans(const float* a, const float* b, float* c, int M, int N, int K)
+{
+    // CBLAS wants leading dimensions of at least 1
+    const int ld = std::max(1, K);
+    gemm(Trans::no, Trans::yes, M, N, K, 1.0f, a, ld, b, ld, 0.0f, c, std::max(1, N));
+}
+
 double cosine_distance(const ublas::vector<double>& v1, const ublas::vector<double>& v2)
 {
     return dot_product(v1, v2) / (magnitude(v1) * magnitude(v2));
@@ -87,6 +683,124 @@ std::vector<int> nearest_neighbors(const ublas::vector<double>& v, const std::ve
     return ret;
 }
 
+namespace {
+
+// The rows of `points` are scanned in blocks of this many rows, and the
+// queries in blocks of this many rows, to bound the size of the similarity
+// matrix of a block to nn_query_block x nn_point_block
+const int nn_point_block = 256;
+const int nn_query_block = 64;
+
+// Push the similarities of the unit `queries` (an nq x D matrix) to the rows
+// [begin, end) of `points` to `tops`
+void scan_points(const ublas::matrix<double>& queries, const ublas::matrix<double>& points,
+                 const std::vector<double>& norms, long begin, long end, std::vector<TopK>& tops)
+{
+    const int B = queries.size1();
+    const int D = queries.size2();
+    std::vector<double> scores(std::min(B, nn_query_block) * nn_point_block);
+    for (long p = begin;  p < end;  p += nn_point_block) {
+        const int np = std::min<long>(nn_point_block, end - p);
+        for (int q = 0;  q < B;  q += nn_query_block) {
+            const int nq = std::min(nn_query_block, B - q);
+            prod_trans(&queries(q, 0), &points(p, 0), scores.data(), nq, np, D);
+            for (int b = 0;  b < nq;  ++b) {
+                const double* row = &scores[b * np];
+                for (int i = 0;  i < np;  ++i)
+                    tops[q + b].push(norms[p + i] > 0.0 ? row[i] / norms[p + i] : 0.0, p + i);
+            }
+        }
+    }
+}
+
+} // namespace
+
+std::vector<double> row_norms(const ublas::matrix<double>& points)
+{
+    std::vector<double> ret(points.size1());
+    for (int i = 0;  i < ret.size();  ++i) {
+        const double* row = &points(i, 0);
+        ret[i] = std::sqrt(simd_dot(row, row, points.size2()));
+    }
+    return ret;
+}
+
+std::vector<std::vector<std::pair<double, int>>> nearest_neighbors(
+    const ublas::matrix<double>& queries, const ublas::matrix<double>& points,
+    const std::vector<double>& norms, int k, int threads)
+{
+    const int B = queries.size1();
+    const long N = points.size1();
+    std::vector<std::vector<std::pair<double, int>>> ret(B);
+    if (B == 0 || N == 0 || points.size2() == 0)
+        return ret;
+    // Normalize the queries once, so that only the norms of the points
+    // remain to divide by
+    ublas::matrix<double> unit = queries;
+    for (int b = 0;  b < B;  ++b) {
+        double* row = &unit(b, 0);
+        const double norm = std::sqrt(simd_dot(row, row, unit.size2()));
+        if (norm > 0.0)
+            simd_scale(row, unit.size2(), 1.0 / norm);
+    }
+    threads = std::max(1, static_cast<int>(std::min<long>(threads, N)));
+    // TopK reserves k pairs
+    k = std::min<long>(k, N);
+    std::vector<std::vector<TopK>> tops(threads, std::vector<TopK>(B, TopK(k)));
+    std::vector<std::thread> workers;
+    for (int t = 0;  t < threads;  ++t) {
+        const long begin = N * t / threads;
+        const long end = N * (t + 1) / threads;
+        workers.emplace_back([&unit, &points, &norms, &tops, t, begin, end] {
+            scan_points(unit, points, norms, begin, end, tops[t]);
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    for (int b = 0;  b < B;  ++b) {
+        for (int t = 1;  t < threads;  ++t)
+            tops[0][b].merge(tops[t][b]);
+        ret[b] = tops[0][b].sorted();
+    }
+    return ret;
+}
+
+std::vector<std::pair<double, int>> nearest_neighbors(
+    const ublas::vector<double>& v, const ublas::matrix<double>& points,
+    const std::vector<double>& norms, int k, int threads)
+{
+    ublas::matrix<double> queries(1, v.size());
+    std::copy(v.begin(), v.end(), queries.data().begin());
+    return nearest_neighbors(queries, points, norms, k, threads).front();
+}
+
+TopK::TopK(int k)
+    : k(k)
+{
+    heap.reserve(k);
+}
+
+void TopK::merge(const TopK& other)
+{
+    for (const auto& p : other.heap)
+        push(p.first, p.second);
+}
+
+std::vector<std::pair<double, int>> TopK::sorted() const
+{
+    std::vector<std::pair<double, int>> ret = heap;
+    std::sort(ret.begin(), ret.end(), std::greater<>());
+    return ret;
+}
+
+std::vector<std::pair<double, int>> top_k(const ublas::vector<double>& v, int k)
+{
+    TopK top(std::min<int>(k, v.size()));
+    for (int i = 0;  i < v.size();  ++i)
+        top.push(v[i], i);
+    return top.sorted();
+}
+
 void add(std::vector<ublas::vector<double>>& to, const std::vector<ublas::vector<double>>& other)
 {
     for (int i = 0;  i < to.size();  ++i)
@@ -1,17 +1,99 @@
 #include <toynet/ublas/ublas.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
 #include <vector>
 #include <boost/numeric/ublas/matrix.hpp>
 #include <boost/numeric/ublas/vector.hpp>
 
 namespace toynet {
 
+// SIMD kernels
+// The instruction sets of the SIMD kernels, from the slowest to the fastest.
+// Each kernel has one implementation per level; the fastest level supported
+// by the CPU is detected at runtime (with CPUID), so that the build does not
+// need any -march flag.
+enum class SimdLevel { scalar, sse2, avx2, avx512 };
+
+// The fastest level supported by the CPU: avx512 needs AVX-512F, avx2 needs
+// AVX2 and FMA, and sse2 is always available on x86-64
+SimdLevel simd_level();
+
+// The name of `level`, e.g. "avx2"
+const char* simd_level_name(SimdLevel level);
+
+// dot product of the `n` scalars at `a` and `b`
+// pre-condition: level <= simd_level()
+double simd_dot(const double* a, const double* b, int n, SimdLevel level=simd_level());
+
+float simd_dot(const float* a, const float* b, int n, SimdLevel level=simd_level());
+
+// maximum of the `n` scalars at `x`
+// pre-condition: n > 0
+// pre-condition: level <= simd_level()
+double simd_max(const double* x, int n, SimdLevel level=simd_level());
+
+// x[i] *= a for each of the `n` scalars at `x`
+// pre-condition: level <= simd_level()
+void simd_scale(double* x, int n, double a, SimdLevel level=simd_level());
+
+// The accuracy of exp in the softmax functions.  `exact` calls std::exp;
+// the other tiers use a vectorized polynomial approximation, which is several
+// times faster, with a maximum relative error of:
+// - high: 1e-8 (degree 7)
+// - low: 1e-4 (degree 4), enough for ranking and sampling
+// Arguments below -708 give 0 instead of a denormal.
+enum class ExpAccuracy { exact, high, low };
+
+// out[i] = exp(x[i] - shift) for each of the `n` scalars at `x`, and return
+// the sum of the results.  `out` may be `x`, or nullptr when only the sum is
+// needed.
+// pre-condition: level <= simd_level()
+double simd_exp(double* out, const double* x, int n, double shift=0.0,
+                ExpAccuracy accuracy=ExpAccuracy::exact, SimdLevel level=simd_level());
+
 // softmax
 ublas::vector<double> softmax(const ublas::vector<double>& v);
 
+ublas::vector<double> softmax(const ublas::vector<double>& v, ExpAccuracy accuracy);
+
 ublas::vector<double> naive_softmax(const ublas::vector<double>& v);
 
 ublas::vector<double> stable_softmax(const ublas::vector<double>& v);
 
+// `stable_softmax` with the max and the normalization in SIMD kernels
+ublas::vector<double> simd_softmax(const ublas::vector<double>& v);
+
+// softmax of each row of `m`, in place
+void softmax_rows(ublas::matrix<double>& m);
+
+void softmax_rows(ublas::matrix<float>& m);
+
+// softmax of the `n` scalars at `x`, written to `out` without allocating:
+// one pass for the max, one pass that stores exp(x[i] - max) and sums it,
+// and a SIMD scaling pass.  `out` may be `x`.
+// Return value: logsumexp(x), read from the max and the sum of the
+// exponentials, so that log(softmax(x)[i]) = x[i] - logsumexp(x) needs no
+// other pass
+double softmax_into(double* out, const double* x, int n, ExpAccuracy accuracy=ExpAccuracy::exact);
+
+// pre-condition: out.size() == v.size()
+double softmax_into(ublas::vector<double>& out, const ublas::vector<double>& v,
+                  ExpAccuracy accuracy=ExpAccuracy::exact);
+
+// log(sum_i(exp(x[i]))), computed as max + log(sum_i(exp(x[i] - max))) so
+// that it neither overflows nor underflows; -infinity if n == 0
+double logsumexp(const double* x, int n, ExpAccuracy accuracy=ExpAccuracy::exact);
+
+double logsumexp(const ublas::vector<double>& v, ExpAccuracy accuracy=ExpAccuracy::exact);
+
+// log(softmax(v)[i]) = v[i] - logsumexp(v), without computing the softmax
+// pre-condition: 0 <= i < v.size()
+double log_softmax_at(const ublas::vector<double>& v, int i, ExpAccuracy accuracy=ExpAccuracy::exact);
+
+// logistic function: 1 / (1 + exp(-x))
+double sigmoid(double x);
+
 // magnitude
 double magnitude(const ublas::vector<double>& v);
 
@@ -19,6 +101,8 @@ double naive_magnitude(const ublas::vector<double>& v);
 
 double ublas_magnitude(const ublas::vector<double>& v);
 
+double simd_magnitude(const ublas::vector<double>& v);
+
 // dot product
 // pre-condition: v1.size() == v2.size()
 double dot_product(const ublas::vector<double>& v1, const ublas::vector<double>& v2);
@@ -27,6 +111,27 @@ double naive_dot_product(const ublas::vector<double>& v1, const ublas::vector<do
 
 double ublas_dot_product(const ublas::vector<double>& v1, const ublas::vector<double>& v2);
 
+double simd_dot_product(const ublas::vector<double>& v1, const ublas::vector<double>& v2);
+
+// matrix product with the second operand transposed: a * trans(b)
+// i.e. ret(i, j) is the dot product of row i of `a` and row j of `b`.
+// Computed by `gemm` (see blas.h), so it uses the CBLAS library when toynet
+// is configured with -DTOYNET_CBLAS=ON.
+// pre-condition: a.size2() == b.size2()
+ublas::matrix<double> prod_trans(const ublas::matrix<double>& a, const ublas::matrix<double>& b);
+
+ublas::matrix<double> naive_prod_trans(const ublas::matrix<double>& a, const ublas::matrix<double>& b);
+
+ublas::matrix<double> ublas_prod_trans(const ublas::matrix<double>& a, const ublas::matrix<double>& b);
+
+ublas::matrix<float> prod_trans(const ublas::matrix<float>& a, const ublas::matrix<float>& b);
+
+// Like `prod_trans`, over raw row-major storage: `a` is M x K, `b` is N x K,
+// and the M x N result is written to `c`
+void prod_trans(const double* a, const double* b, double* c, int M, int N, int K);
+
+void prod_trans(const float* a, const float* b, float* c, int M, int N, int K);
+
 // pre-condition: v1.size() == v2.size()
 // pre-condition: ||v1|| != 0 && ||v2|| != 0
 double cosine_distance(const ublas::vector<double>& v1, const ublas::vector<double>& v2);
@@ -35,6 +140,67 @@ double cosine_distance(const ublas::vector<double>& v1, const ublas::vector<doub
 // pre-condition: for each p in points: p.size() == v.size() && ||p|| != 0
 std::vector<int> nearest_neighbors(const ublas::vector<double>& v, const std::vector<ublas::vector<double>>& points);
 
+// The norm of each row of `points`, for the `nearest_neighbors` overloads below
+std::vector<double> row_norms(const ublas::matrix<double>& points);
+
+// For each row of `queries`, the `k` rows of `points` with the largest cosine
+// similarity, as (cosine similarity, row index) pairs sorted descending.
+// `norms` are the `row_norms` of `points`, computed once for all searches;
+// rows of zero norm have a similarity of 0.  The rows of `points` are split
+// across `threads` threads, each of which scans its share in blocks with
+// `prod_trans` and keeps one `TopK` per query; the heaps are merged at the
+// end.  Nothing is allocated per point, so that a search is bound by the
+// memory bandwidth.
+// Return value: a list of queries.size1() lists of size min(k, points.size1())
+// pre-condition: queries.size2() == points.size2()
+// pre-condition: norms.size() == points.size1()
+// pre-condition: k >= 0 && threads >= 1
+std::vector<std::vector<std::pair<double, int>>> nearest_neighbors(
+    const ublas::matrix<double>& queries, const ublas::matrix<double>& points,
+    const std::vector<double>& norms, int k, int threads=1);
+
+// pre-condition: v.size() == points.size2()
+std::vector<std::pair<double, int>> nearest_neighbors(
+    const ublas::vector<double>& v, const ublas::matrix<double>& points,
+    const std::vector<double>& norms, int k, int threads=1);
+
+// Keeps the `k` largest (score, index) pairs out of all the pairs pushed,
+// in a bounded min-heap: pushing n pairs costs O(n * log(k)) time and O(k)
+// memory, instead of O(n * log(n)) time and O(n) memory to sort them all.
+// Pairs are compared like `std::pair`, so ties on the score keep the pairs
+// with the largest index, as when sorting with `std::greater<>`.
+struct TopK {
+    // pre-condition: k >= 0
+    explicit TopK(int k);
+
+    void push(double score, int index)
+    {
+        const std::pair<double, int> p(score, index);
+        if (heap.size() < k) {
+            heap.push_back(p);
+            std::push_heap(heap.begin(), heap.end(), std::greater<>());
+        } else if (k > 0 && p > heap.front()) {
+            std::pop_heap(heap.begin(), heap.end(), std::greater<>());
+            heap.back() = p;
+            std::push_heap(heap.begin(), heap.end(), std::greater<>());
+        }
+    }
+
+    // Push all the pairs kept by `other`
+    void merge(const TopK& other);
+
+    // The pairs kept so far, sorted descending
+    std::vector<std::pair<double, int>> sorted() const;
+
+    int k;
+    std::vector<std::pair<double, int>> heap;
+};
+
+// The `k` largest elements of `v` as (value, index) pairs, sorted descending
+// Return value: a list of size min(k, v.size())
+// pre-condition: k >= 0
+std::vector<std::pair<double, int>> top_k(const ublas::vector<double>& v, int k);
+
 // element-wise addition
 // pre-condition: to.size() == other.size()
 void add(std::vector<ublas::vector<double>>& to, const std::vector<ublas::vector<double>>& other);
@@ -3,6 +3,10 @@
 #include <toynet/ublas/convert.h>
 #include <toynet/ublas/io.h>
 #include <toynet/ublas/test.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
 #include <boost/test/unit_test.hpp>
 
 using namespace toynet;
@@ -66,6 +70,15 @@ BOOST_AUTO_TEST_CASE(test_naive_softmax)
     help_test_softmax_size_2(naive_softmax);
 }
 
+BOOST_AUTO_TEST_CASE(test_simd_softmax)
+{
+    help_test_softmax_size_0(simd_softmax);
+    help_test_softmax_size_1(simd_softmax);
+    help_test_softmax_size_1_sum_0(simd_softmax);
+    help_test_softmax_size_2(simd_softmax);
+    help_test_softmax_numerical_stability(simd_softmax);
+}
+
 BOOST_AUTO_TEST_CASE(test_stable_softmax)
 {
     help_test_softmax_size_0(stable_softmax);
@@ -75,6 +88,63 @@ BOOST_AUTO_TEST_CASE(test_stable_softmax)
     help_test_softmax_numerical_stability(stable_softmax);
 }
 
+BOOST_AUTO_TEST_CASE(test_softmax_rows)
+{
+    ublas::matrix<double> m(2, 2);
+    m(0, 0) = 1.0;
+    m(0, 1) = 2.0;
+    m(1, 0) = 10000.0;
+    m(1, 1) = 4.0;
+    softmax_rows(m);
+    BOOST_CHECK_CLOSE(0.26894142, m(0, 0), 1e-5);
+    BOOST_CHECK_CLOSE(0.73105858, m(0, 1), 1e-5);
+    BOOST_CHECK_EQUAL(1.0, m(1, 0));
+    BOOST_CHECK_EQUAL(0.0, m(1, 1));
+}
+
+BOOST_AUTO_TEST_CASE(test_softmax_into)
+{
+    const ublas::vector<double> v = convert({10, 2, 10000, 4, 1, 2, 3, 4, 5, 6, 7});
+    ublas::vector<double> out(v.size());
+    BOOST_CHECK_CLOSE(logsumexp(v), softmax_into(out, v), 1e-12);
+    check_close_vectors(stable_softmax(v), out);
+    // in place
+    ublas::vector<double> w = v;
+    BOOST_CHECK_CLOSE(logsumexp(v), softmax_into(w, w), 1e-12);
+    check_close_vectors(stable_softmax(v), w);
+    ublas::vector<double> empty;
+    BOOST_CHECK_EQUAL(-std::numeric_limits<double>::infinity(), softmax_into(empty, empty));
+}
+
+BOOST_AUTO_TEST_CASE(test_logsumexp)
+{
+    BOOST_CHECK_EQUAL(-std::numeric_limits<double>::infinity(), logsumexp(ublas::vector<double>()));
+    BOOST_CHECK_CLOSE(5.0, logsumexp(convert({5.0})), 1e-10);
+    BOOST_CHECK_CLOSE(2.3132616875182226, logsumexp(convert({1.0, 2.0})), 1e-10);
+    // no overflow nor underflow
+    BOOST_CHECK_CLOSE(10000.0, logsumexp(convert({10, 2, 10000, 4})), 1e-10);
+    BOOST_CHECK_CLOSE(-10000.0 + std::log(2.0), logsumexp(convert({-10000, -10000})), 1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(test_log_softmax_at)
+{
+    const ublas::vector<double> v = convert({1.0, 2.0});
+    BOOST_CHECK_CLOSE(std::log(0.26894142), log_softmax_at(v, 0), 1e-5);
+    BOOST_CHECK_CLOSE(std::log(0.73105858), log_softmax_at(v, 1), 1e-5);
+    // finite where log(softmax(v)[i]) would be -infinity
+    const ublas::vector<double> w = convert({10000, 0});
+    BOOST_CHECK_CLOSE(-10000.0, log_softmax_at(w, 1), 1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(test_sigmoid)
+{
+    BOOST_CHECK_EQUAL(0.5, sigmoid(0.0));
+    BOOST_CHECK_CLOSE(0.7310585786300049, sigmoid(1.0), 1e-10);
+    BOOST_CHECK_CLOSE(0.2689414213699951, sigmoid(-1.0), 1e-10);
+    BOOST_CHECK_EQUAL(1.0, sigmoid(1000.0));
+    BOOST_CHECK_EQUAL(0.0, sigmoid(-1000.0));
+}
+
 void help_test_magnitude_size_0(double (*fn)(const ublas::vector<double>&))
 {
     const ublas::vector<double> v;
@@ -113,6 +183,13 @@ BOOST_AUTO_TEST_CASE(test_naive_magnitude)
     help_test_magnitude_size_2(naive_magnitude);
 }
 
+BOOST_AUTO_TEST_CASE(test_simd_magnitude)
+{
+    help_test_magnitude_size_0(simd_magnitude);
+    help_test_magnitude_size_1(simd_magnitude);
+    help_test_magnitude_size_2(simd_magnitude);
+}
+
 BOOST_AUTO_TEST_CASE(test_ublas_magnitude)
 {
     help_test_magnitude_size_0(ublas_magnitude);
@@ -168,6 +245,101 @@ BOOST_AUTO_TEST_CASE(test_ublas_dot_product)
     help_test_dot_product_size_2(ublas_dot_product);
 }
 
+BOOST_AUTO_TEST_CASE(test_simd_dot_product)
+{
+    help_test_dot_product_size_0(simd_dot_product);
+    help_test_dot_product_size_1(simd_dot_product);
+    help_test_dot_product_size_2(simd_dot_product);
+}
+
+// Compare the kernels of each level supported by the CPU against the naive
+// versions, for sizes covering the vectorized loops and their tails
+BOOST_AUTO_TEST_CASE(test_simd_kernels)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (SimdLevel level : {SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2, SimdLevel::avx512}) {
+        if (level > simd_level())
+            continue;
+        BOOST_TEST_MESSAGE("level " << simd_level_name(level));
+        for (int n = 0;  n <= 67;  ++n) {
+            ublas::vector<double> a(n), b(n);
+            std::vector<float> fa(n), fb(n);
+            for (int i = 0;  i < n;  ++i) {
+                fa[i] = a[i] = dist(rng);
+                fb[i] = b[i] = dist(rng);
+            }
+            BOOST_CHECK_SMALL(naive_dot_product(a, b) - simd_dot(a.data().begin(), b.data().begin(), n, level), 1e-12);
+            float expected = 0;
+            for (int i = 0;  i < n;  ++i)
+                expected += fa[i] * fb[i];
+            BOOST_CHECK_SMALL(expected - simd_dot(fa.data(), fb.data(), n, level), 1e-4f);
+            if (n == 0)
+                continue;
+            BOOST_CHECK_EQUAL(*std::max_element(a.begin(), a.end()), simd_max(&a[0], n, level));
+            ublas::vector<double> scaled = a;
+            simd_scale(&scaled[0], n, -2.5, level);
+            for (int i = 0;  i < n;  ++i)
+                BOOST_CHECK_EQUAL(a[i] * -2.5, scaled[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_simd_exp)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(-700.0, 700.0);
+    std::vector<double> x(1003);
+    for (double& xi : x)
+        xi = dist(rng);
+    x[0] = 0.0;
+    x[1] = -1000.0;
+    x[2] = -std::numeric_limits<double>::infinity();
+    // maximum relative error of each accuracy, in percent
+    const std::pair<ExpAccuracy, double> tiers[] = {
+        {ExpAccuracy::exact, 1e-12}, {ExpAccuracy::high, 1e-6}, {ExpAccuracy::low, 1e-2},
+    };
+    for (SimdLevel level : {SimdLevel::scalar, SimdLevel::sse2, SimdLevel::avx2, SimdLevel::avx512}) {
+        if (level > simd_level())
+            continue;
+        BOOST_TEST_MESSAGE("level " << simd_level_name(level));
+        for (auto tier : tiers) {
+            // all the tail lengths, then a long vector
+            for (int n : {0, 1, 2, 3, 5, 7, 8, 9, 15, 17, 1003}) {
+                std::vector<double> out(n);
+                const double sum = simd_exp(out.data(), x.data(), n, 0.5, tier.first, level);
+                double expected = 0;
+                for (int i = 0;  i < n;  ++i) {
+                    BOOST_CHECK_CLOSE(std::exp(x[i] - 0.5), out[i], tier.second);
+                    expected += std::exp(x[i] - 0.5);
+                }
+                if (n > 2) {
+                    BOOST_CHECK_EQUAL(0.0, out[1]);
+                    BOOST_CHECK_EQUAL(0.0, out[2]);
+                }
+                BOOST_CHECK_CLOSE(expected, sum, tier.second);
+                BOOST_CHECK_EQUAL(sum, simd_exp(nullptr, x.data(), n, 0.5, tier.first, level));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_softmax_accuracy)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(-10.0, 10.0);
+    ublas::vector<double> v(100);
+    for (double& x : v)
+        x = dist(rng);
+    check_close_vectors(naive_softmax(v), softmax(v, ExpAccuracy::exact), 1e-10);
+    check_close_vectors(naive_softmax(v), softmax(v, ExpAccuracy::high), 1e-5);
+    check_close_vectors(naive_softmax(v), softmax(v, ExpAccuracy::low), 2e-2);
+    BOOST_CHECK_CLOSE(std::log(naive_softmax(v)[3]), log_softmax_at(v, 3, ExpAccuracy::low), 1e-2);
+    help_test_softmax_numerical_stability([](const ublas::vector<double>& v) {
+        return softmax(v, ExpAccuracy::low);
+    });
+}
+
 BOOST_AUTO_TEST_CASE(cosine_distance_a)
 {
     // https://stackoverflow.com/a/1750187
@@ -252,3 +424,153 @@ BOOST_AUTO_TEST_CASE(nearest_neighbors_size_4)
     const std::vector<int> got = nearest_neighbors(v, points);
     BOOST_CHECK_EQUAL(expected, got);
 }
+
+ublas::matrix<double> random_matrix(int rows, int cols, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    ublas::matrix<double> ret(rows, cols);
+    for (int i = 0;  i < rows;  ++i)
+        for (int j = 0;  j < cols;  ++j)
+            ret(i, j) = dist(rng);
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(nearest_neighbors_matrix)
+{
+    std::mt19937 rng(3);
+    // more points than a block, and not a multiple of it
+    ublas::matrix<double> points = random_matrix(1000, 7, rng);
+    ublas::row(points, 17) = ublas::zero_vector<double>(7);
+    const std::vector<double> norms = row_norms(points);
+    BOOST_CHECK_EQUAL(0.0, norms[17]);
+    BOOST_CHECK_CLOSE(magnitude(ublas::row(points, 3)), norms[3], 1e-10);
+    const ublas::matrix<double> queries = random_matrix(70, 7, rng);
+    // brute force, with a similarity of 0 for the zero row
+    std::vector<std::vector<std::pair<double, int>>> expected(queries.size1());
+    for (int b = 0;  b < queries.size1();  ++b) {
+        for (int i = 0;  i < points.size1();  ++i) {
+            const double s = i == 17 ? 0.0 : cosine_distance(ublas::row(queries, b), ublas::row(points, i));
+            expected[b].emplace_back(s, i);
+        }
+        std::sort(expected[b].begin(), expected[b].end(), std::greater<>());
+    }
+    for (int threads : {1, 3}) {
+        for (int k : {0, 1, 10}) {
+            const auto got = nearest_neighbors(queries, points, norms, k, threads);
+            BOOST_REQUIRE_EQUAL(queries.size1(), got.size());
+            for (int b = 0;  b < queries.size1();  ++b) {
+                BOOST_REQUIRE_EQUAL(k, got[b].size());
+                for (int i = 0;  i < k;  ++i) {
+                    BOOST_CHECK_EQUAL(expected[b][i].second, got[b][i].second);
+                    BOOST_CHECK_CLOSE(expected[b][i].first, got[b][i].first, 1e-8);
+                }
+            }
+        }
+    }
+    // a single query, and k larger than the number of points
+    const ublas::vector<double> v = convert({-1, -1, 0});
+    ublas::matrix<double> small(2, 3);
+    ublas::row(small, 0) = convert({-1, 0, -1});
+    ublas::row(small, 1) = convert({-2, -2, 0});
+    const auto got = nearest_neighbors(v, small, row_norms(small), std::numeric_limits<int>::max(), 4);
+    BOOST_REQUIRE_EQUAL(2, got.size());
+    BOOST_CHECK_EQUAL(1, got[0].second);
+    BOOST_CHECK_CLOSE(1.0, got[0].first, 1e-10);
+    BOOST_CHECK_EQUAL(0, got[1].second);
+    BOOST_CHECK_CLOSE(0.5, got[1].first, 1e-10);
+}
+
+void help_test_prod_trans(ublas::matrix<double> (*fn)(const ublas::matrix<double>&, const ublas::matrix<double>&))
+{
+    std::mt19937 rng(0);
+    // Include sizes that are not multiples of the register tiles
+    for (int M : {0, 1, 4, 7})
+    for (int N : {0, 1, 5, 8, 2049})
+    for (int K : {0, 1, 3, 50}) {
+        const ublas::matrix<double> a = random_matrix(M, K, rng);
+        const ublas::matrix<double> b = random_matrix(N, K, rng);
+        const ublas::matrix<double> expected = naive_prod_trans(a, b);
+        const ublas::matrix<double> got = (*fn)(a, b);
+        BOOST_REQUIRE_EQUAL(M, got.size1());
+        BOOST_REQUIRE_EQUAL(N, got.size2());
+        for (int i = 0;  i < M;  ++i)
+            for (int j = 0;  j < N;  ++j)
+                BOOST_CHECK_SMALL(expected(i, j) - got(i, j), 1e-12);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_naive_prod_trans)
+{
+    ublas::matrix<double> a(2, 2);
+    a(0, 0) = 1.0;  a(0, 1) = 2.0;
+    a(1, 0) = 3.0;  a(1, 1) = 4.0;
+    ublas::matrix<double> b(1, 2);
+    b(0, 0) = -1.0;  b(0, 1) = 0.5;
+    const ublas::matrix<double> got = naive_prod_trans(a, b);
+    BOOST_REQUIRE_EQUAL(2, got.size1());
+    BOOST_REQUIRE_EQUAL(1, got.size2());
+    BOOST_CHECK_EQUAL(0.0, got(0, 0));
+    BOOST_CHECK_EQUAL(-1.0, got(1, 0));
+}
+
+BOOST_AUTO_TEST_CASE(test_prod_trans)
+{
+    help_test_prod_trans(prod_trans);
+}
+
+BOOST_AUTO_TEST_CASE(test_ublas_prod_trans)
+{
+    help_test_prod_trans(ublas_prod_trans);
+}
+
+BOOST_AUTO_TEST_CASE(test_prod_trans_float)
+{
+    std::mt19937 rng(0);
+    const ublas::matrix<double> a = random_matrix(7, 50, rng);
+    const ublas::matrix<double> b = random_matrix(9, 50, rng);
+    const ublas::matrix<double> expected = naive_prod_trans(a, b);
+    const ublas::matrix<float> got = prod_trans(ublas::matrix<float>(a), ublas::matrix<float>(b));
+    BOOST_REQUIRE_EQUAL(7, got.size1());
+    BOOST_REQUIRE_EQUAL(9, got.size2());
+    for (int i = 0;  i < 7;  ++i)
+        for (int j = 0;  j < 9;  ++j)
+            BOOST_CHECK_SMALL(expected(i, j) - got(i, j), 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE(TopK_push)
+{
+    TopK top(3);
+    for (int i : {5, 1, 9, 3, 7, 2})
+        top.push(i * 0.5, i);
+    const std::vector<std::pair<double, int>> expected{{4.5, 9}, {3.5, 7}, {2.5, 5}};
+    BOOST_CHECK_EQUAL(expected, top.sorted());
+}
+
+BOOST_AUTO_TEST_CASE(TopK_k_0)
+{
+    TopK top(0);
+    top.push(1.0, 0);
+    BOOST_CHECK(top.sorted().empty());
+}
+
+BOOST_AUTO_TEST_CASE(TopK_merge)
+{
+    TopK top1(2);
+    TopK top2(2);
+    top1.push(1.0, 0);
+    top1.push(4.0, 1);
+    top2.push(3.0, 2);
+    top2.push(2.0, 3);
+    top1.merge(top2);
+    const std::vector<std::pair<double, int>> expected{{4.0, 1}, {3.0, 2}};
+    BOOST_CHECK_EQUAL(expected, top1.sorted());
+}
+
+BOOST_AUTO_TEST_CASE(top_k_ties)
+{
+    // same order as a full descending sort
+    const ublas::vector<double> v = convert({1.0, 2.0, 2.0, 0.5, 2.0});
+    const std::vector<std::pair<double, int>> expected{{2.0, 4}, {2.0, 2}};
+    BOOST_CHECK_EQUAL(expected, top_k(v, 2));
+    BOOST_CHECK_EQUAL(5, top_k(v, 10).size());
+}
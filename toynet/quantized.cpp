@@ -0,0 +1,368 @@
+#include <toynet/quantized.h>
+#include <toynet/math.h>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace toynet {
+
+namespace {
+
+template<class T>
+float quantize_impl(const T* x, int n, std::int8_t* out)
+{
+    T max = 0;
+    for (int i = 0;  i < n;  ++i)
+        max = std::max(max, std::abs(x[i]));
+    if (max == 0) {
+        std::fill(out, out + n, 0);
+        return 0.0f;
+    }
+    const T inv = 127 / max;
+    for (int i = 0;  i < n;  ++i)
+        out[i] = std::lround(x[i] * inv);
+    return max / 127;
+}
+
+template<class T>
+void quantize_rows(const BasicEmbeddingMatrix<T>& m, QuantizedMatrix& q)
+{
+    q.rows = m.size1();
+    q.cols = m.size2();
+    q.scales.resize(q.rows);
+    q.data.resize(std::size_t(q.rows) * q.cols);
+    for (int i = 0;  i < q.rows;  ++i)
+        q.scales[i] = quantize(&m.data()[0] + std::size_t(i) * q.cols, q.cols, &q.data[std::size_t(i) * q.cols]);
+}
+
+// Euclidean norm of the int8 values of each row of `m`, without the scales
+std::vector<float> row_norms(const QuantizedMatrix& m)
+{
+    std::vector<float> ret(m.size1());
+    for (int i = 0;  i < m.size1();  ++i)
+        ret[i] = std::sqrt(double(dot_int8(m.row(i), m.row(i), m.size2())));
+    return ret;
+}
+
+template<class T>
+void copy_model(const BasicCBOWModel<T>& model, QuantizedCBOWModel& q)
+{
+    q.W = model.W;
+    q.D = model.D;
+    q.historyN = model.historyN;
+    q.futureN = model.futureN;
+    q.P = QuantizedMatrix(model.P);
+    q.O = QuantizedMatrix(model.O);
+    q.tree = model.tree;
+    q.norms = row_norms(q.P);
+}
+
+// The quantized average embedding of a context, and its scale
+struct QuantizedContext {
+    QuantizedContext(const QuantizedCBOWModel& model, const std::vector<int>& context)
+        : data(model.D)
+    {
+        std::vector<float> avg(model.D, 0.0f);
+        for (int wordidx : context) {
+            const std::int8_t* p = model.P.row(wordidx);
+            const float s = model.P.scales[wordidx];
+            for (int i = 0;  i < model.D;  ++i)
+                avg[i] += s * p[i];
+        }
+        scale = quantize(avg.data(), model.D, data.data()) / context.size();
+    }
+
+    // The logit of row `k` of O
+    double logit(const QuantizedCBOWModel& model, int k) const
+    {
+        return double(scale) * model.O.scales[k] * dot_int8(data.data(), model.O.row(k), model.D);
+    }
+
+    std::vector<std::int8_t> data;
+    float scale;
+};
+
+// p(word | context) for each word
+ublas::vector<double> probabilities(const QuantizedCBOWModel& model, const std::vector<int>& context)
+{
+    const QuantizedContext avg(model, context);
+    const int W = model.W;
+    if (!model.hierarchical()) {
+        ublas::vector<double> out(W);
+        for (int k = 0;  k < W;  ++k)
+            out[k] = avg.logit(model, k);
+        softmax_into(out, out);
+        return out;
+    }
+    const HuffmanTree& tree = model.tree;
+    std::vector<double> x(W - 1);
+    for (int n = 0;  n < W - 1;  ++n)
+        x[n] = avg.logit(model, n);
+    ublas::vector<double> ret(W);
+    for (int w = 0;  w < W;  ++w) {
+        double p = 1.0;
+        for (int j = tree.offsets[w];  j < tree.offsets[w+1];  ++j)
+            p *= sigmoid(tree.codes[j] ? -x[tree.points[j]] : x[tree.points[j]]);
+        ret[w] = p;
+    }
+    return ret;
+}
+
+// See `QuantizedCBOWModel::save`
+struct BinaryHeader {
+    char magic[8];
+    std::int32_t version;
+    std::int32_t W;
+    std::int32_t D;
+    std::int32_t historyN;
+    std::int32_t futureN;
+    std::int32_t reserved0;
+    std::int64_t tree_points;
+    char reserved[24];
+};
+
+static_assert(sizeof(BinaryHeader) == 64, "BinaryHeader must be 64 bytes");
+
+const char binary_magic[8] = {'T', 'O', 'Y', 'N', 'E', 'T', 'Q', '8'};
+const int binary_version = 1;
+const std::size_t binary_alignment = 64;
+
+std::size_t align_up(std::size_t n)
+{
+    return (n + binary_alignment - 1) / binary_alignment * binary_alignment;
+}
+
+// Byte offsets of each section of the binary format
+struct BinaryLayout {
+    explicit BinaryLayout(const BinaryHeader& h)
+        : P_scales(sizeof(BinaryHeader))
+        , P(align_up(P_scales + std::size_t(h.W) * 4))
+        , O_scales(align_up(P + std::size_t(h.W) * h.D))
+        , O(align_up(O_scales + std::size_t(h.W) * 4))
+        , tree(align_up(O + std::size_t(h.W) * h.D))
+        , end(tree + (h.tree_points > 0 ? (h.W + 1 + h.tree_points) * 4 + h.tree_points : 0))
+    {
+    }
+    std::size_t P_scales;
+    std::size_t P;
+    std::size_t O_scales;
+    std::size_t O;
+    std::size_t tree;
+    std::size_t end;
+};
+
+// Write `n` bytes from `data` at offset `offset` of the stream, after padding
+// the stream from its current offset `pos`
+void write_section(std::ostream& os, std::size_t& pos, std::size_t offset, const void* data, std::size_t n)
+{
+    static const char padding[binary_alignment] = {};
+    os.write(padding, offset - pos);
+    os.write(static_cast<const char*>(data), n);
+    pos = offset + n;
+}
+
+// Read `n` bytes to `data` from offset `offset` of a stream that is at offset
+// `pos`, skipping the padding in between
+void read_section(std::istream& is, std::size_t& pos, std::size_t offset, void* data, std::size_t n)
+{
+    if (!is.ignore(offset - pos) || !is.read(static_cast<char*>(data), n))
+        throw std::runtime_error("QuantizedCBOWModel: truncated model");
+    pos = offset + n;
+}
+
+void read_matrix(std::istream& is, std::size_t& pos, const BinaryHeader& h,
+                 std::size_t scales_offset, std::size_t data_offset, QuantizedMatrix& m)
+{
+    m.rows = h.W;
+    m.cols = h.D;
+    m.scales.resize(h.W);
+    m.data.resize(std::size_t(h.W) * h.D);
+    read_section(is, pos, scales_offset, m.scales.data(), m.scales.size() * 4);
+    read_section(is, pos, data_offset, m.data.data(), m.data.size());
+}
+
+} // namespace
+
+float quantize(const double* x, int n, std::int8_t* out)
+{
+    return quantize_impl(x, n, out);
+}
+
+float quantize(const float* x, int n, std::int8_t* out)
+{
+    return quantize_impl(x, n, out);
+}
+
+std::int32_t dot_int8(const std::int8_t* a, const std::int8_t* b, int n)
+{
+    // Products fit in 16 bits; summing in independent 32-bit lanes lets the
+    // compiler vectorize the loop
+    std::int32_t sums[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    int i = 0;
+    for (;  i + 8 <= n;  i += 8)
+        for (int j = 0;  j < 8;  ++j)
+            sums[j] += std::int16_t(a[i + j] * b[i + j]);
+    std::int32_t ret = 0;
+    for (;  i < n;  ++i)
+        ret += a[i] * b[i];
+    for (int j = 0;  j < 8;  ++j)
+        ret += sums[j];
+    return ret;
+}
+
+std::int32_t naive_dot_int8(const std::int8_t* a, const std::int8_t* b, int n)
+{
+    std::int32_t ret = 0;
+    for (int i = 0;  i < n;  ++i)
+        ret += a[i] * b[i];
+    return ret;
+}
+
+QuantizedMatrix::QuantizedMatrix(const BasicEmbeddingMatrix<double>& m)
+{
+    quantize_rows(m, *this);
+}
+
+QuantizedMatrix::QuantizedMatrix(const BasicEmbeddingMatrix<float>& m)
+{
+    quantize_rows(m, *this);
+}
+
+QuantizedCBOWModel::QuantizedCBOWModel(const CBOWModel& model)
+{
+    copy_model(model, *this);
+}
+
+QuantizedCBOWModel::QuantizedCBOWModel(const FloatCBOWModel& model)
+{
+    copy_model(model, *this);
+}
+
+void QuantizedCBOWModel::save(std::ostream& os) const
+{
+    BinaryHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, binary_magic, sizeof(binary_magic));
+    h.version = binary_version;
+    h.W = W;
+    h.D = D;
+    h.historyN = historyN;
+    h.futureN = futureN;
+    h.tree_points = tree.points.size();
+    const BinaryLayout layout(h);
+    os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    std::size_t pos = sizeof(h);
+    write_section(os, pos, layout.P_scales, P.scales.data(), P.scales.size() * 4);
+    write_section(os, pos, layout.P, P.data.data(), P.data.size());
+    write_section(os, pos, layout.O_scales, O.scales.data(), O.scales.size() * 4);
+    write_section(os, pos, layout.O, O.data.data(), O.data.size());
+    write_section(os, pos, layout.tree, nullptr, 0);
+    if (hierarchical()) {
+        os.write(reinterpret_cast<const char*>(tree.offsets.data()), tree.offsets.size() * 4);
+        os.write(reinterpret_cast<const char*>(tree.points.data()), tree.points.size() * 4);
+        os.write(tree.codes.data(), tree.codes.size());
+    }
+}
+
+void QuantizedCBOWModel::load(std::istream& is)
+{
+    BinaryHeader h;
+    if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)))
+        throw std::runtime_error("QuantizedCBOWModel: truncated model");
+    if (std::memcmp(h.magic, binary_magic, sizeof(binary_magic)) != 0)
+        throw std::runtime_error("QuantizedCBOWModel: not a quantized model");
+    if (h.version != binary_version)
+        throw std::runtime_error("QuantizedCBOWModel: unsupported model version " + std::to_string(h.version));
+    if (h.W <= 0 || h.D <= 0 || h.tree_points < 0)
+        throw std::runtime_error("QuantizedCBOWModel: corrupted model header");
+    const BinaryLayout layout(h);
+    // The matrices are read in place; the model is left unchanged if the
+    // stream is truncated
+    QuantizedMatrix newP, newO;
+    HuffmanTree newTree;
+    std::size_t pos = sizeof(h);
+    read_matrix(is, pos, h, layout.P_scales, layout.P, newP);
+    read_matrix(is, pos, h, layout.O_scales, layout.O, newO);
+    if (h.tree_points > 0) {
+        newTree.offsets.resize(h.W + 1);
+        newTree.points.resize(h.tree_points);
+        newTree.codes.resize(h.tree_points);
+        read_section(is, pos, layout.tree, newTree.offsets.data(), newTree.offsets.size() * 4);
+        read_section(is, pos, pos, newTree.points.data(), newTree.points.size() * 4);
+        read_section(is, pos, pos, newTree.codes.data(), newTree.codes.size());
+    }
+    W = h.W;
+    D = h.D;
+    historyN = h.historyN;
+    futureN = h.futureN;
+    P = std::move(newP);
+    O = std::move(newO);
+    tree = std::move(newTree);
+    norms = row_norms(P);
+}
+
+std::vector<std::pair<double, int>> QuantizedCBOWModel::predict(const std::vector<int>& context) const
+{
+    const ublas::vector<double> p = probabilities(*this, context);
+    std::vector<std::pair<double, int>> ret(W);
+    for (int i = 0;  i < W;  ++i)
+        ret[i] = std::make_pair(p[i], i);
+    std::sort(ret.begin(), ret.end(), std::greater<>());
+    return ret;
+}
+
+double QuantizedCBOWModel::predict(const std::vector<int>& context, int word) const
+{
+    if (!hierarchical())
+        return probabilities(*this, context)[word];
+    const QuantizedContext avg(*this, context);
+    double p = 1.0;
+    for (int j = tree.offsets[word];  j < tree.offsets[word+1];  ++j) {
+        const double x = avg.logit(*this, tree.points[j]);
+        p *= sigmoid(tree.codes[j] ? -x : x);
+    }
+    return p;
+}
+
+std::vector<std::pair<double, int>> QuantizedCBOWModel::predict_topk(const std::vector<int>& context, int k, bool normalize) const
+{
+    if (hierarchical())
+        return top_k(probabilities(*this, context), k);
+    const QuantizedContext avg(*this, context);
+    TopK top(std::min(k, W));
+    if (!normalize) {
+        for (int i = 0;  i < W;  ++i)
+            top.push(avg.logit(*this, i), i);
+        return top.sorted();
+    }
+    std::vector<double> out(W);
+    for (int i = 0;  i < W;  ++i) {
+        out[i] = avg.logit(*this, i);
+        top.push(out[i], i);
+    }
+    const double lse = logsumexp(out.data(), W);
+    std::vector<std::pair<double, int>> ret = top.sorted();
+    for (auto& p : ret)
+        p.first = std::exp(p.first - lse);
+    return ret;
+}
+
+double QuantizedCBOWModel::cosine(int a, int b) const
+{
+    // The scales of the rows cancel out
+    if (norms[a] == 0 || norms[b] == 0)
+        return 0.0;
+    return dot_int8(P.row(a), P.row(b), D) / (double(norms[a]) * norms[b]);
+}
+
+std::vector<std::pair<double, int>> QuantizedCBOWModel::nearest(int word, int k) const
+{
+    TopK top(std::min(k, W - 1));
+    for (int i = 0;  i < W;  ++i)
+        if (i != word)
+            top.push(cosine(word, i), i);
+    return top.sorted();
+}
+
+} // namespace toynet
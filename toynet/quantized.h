@@ -0,0 +1,110 @@
+#include <toynet/w2v.h>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace toynet {
+
+// Quantize the `n` scalars at `x` to `out`, such that x[i] ~= scale * out[i],
+// with -127 <= out[i] <= 127.  Returns the scale, max(|x[i]|) / 127, or 0 if
+// all the scalars are 0.
+float quantize(const double* x, int n, std::int8_t* out);
+
+float quantize(const float* x, int n, std::int8_t* out);
+
+// Dot product of two int8 vectors, accumulated in 32-bit integers
+// Pre-conditions: n < 2^31 / 127^2, i.e. about 133000
+std::int32_t dot_int8(const std::int8_t* a, const std::int8_t* b, int n);
+
+std::int32_t naive_dot_int8(const std::int8_t* a, const std::int8_t* b, int n);
+
+// A row-major matrix of int8 values with one scale per row: element (i, j)
+// stands for scales[i] * data[i * size2() + j].  Scaling each row separately
+// keeps the quantization error of a row proportional to its own magnitude.
+struct QuantizedMatrix {
+    QuantizedMatrix() : rows(0), cols(0) {}
+
+    explicit QuantizedMatrix(const BasicEmbeddingMatrix<double>& m);
+
+    explicit QuantizedMatrix(const BasicEmbeddingMatrix<float>& m);
+
+    int size1() const { return rows; }
+    int size2() const { return cols; }
+
+    // Pointer to the first element of row `i`
+    const std::int8_t* row(int i) const { return &data[std::size_t(i) * cols]; }
+
+    // The approximate value of element (i, j)
+    float operator()(int i, int j) const { return scales[i] * row(i)[j]; }
+
+    int rows;
+    int cols;
+    std::vector<float> scales;
+    std::vector<std::int8_t> data;
+};
+
+// An inference-only version of a trained `CBOWModel`, with P and O stored as
+// `QuantizedMatrix`.  It takes 8 times less memory than a `CBOWModel` (4
+// times less than a `FloatCBOWModel`).  The average embedding of a context is
+// computed in floating point, then quantized, so that each output logit is a
+// single integer dot product.
+struct QuantizedCBOWModel {
+    QuantizedCBOWModel() : W(0), D(0), historyN(0), futureN(0) {}
+
+    explicit QuantizedCBOWModel(const CBOWModel& model);
+
+    explicit QuantizedCBOWModel(const FloatCBOWModel& model);
+
+    // Whether the output layer is a hierarchical softmax
+    bool hierarchical() const { return tree.size() > 0; }
+
+    // Save the model to an output stream in a binary format laid out like
+    // `CBOWModel::save_binary`: a 64-byte header (the magic string "TOYNETQ8",
+    // the format version, W, D, historyN and futureN as 4-byte integers, 4
+    // reserved bytes, then the number of inner nodes on all the paths of the
+    // hierarchical softmax tree as an 8-byte integer), then the scales and
+    // the int8 values of P, the scales and the int8 values of O, and the
+    // hierarchical softmax tree, each section starting at an offset that is
+    // a multiple of 64 bytes.  All values are in native byte order.
+    void save(std::ostream& os) const;
+
+    // Load a model saved with `save` from an input stream.
+    // Throws std::runtime_error if the stream is not in the expected format.
+    void load(std::istream& is);
+
+    // See `CBOWModel::predict`
+    std::vector<std::pair<double, int>> predict(const std::vector<int>& context) const;
+
+    // See `CBOWModel::predict`
+    double predict(const std::vector<int>& context, int word) const;
+
+    // See `CBOWModel::predict_topk`
+    std::vector<std::pair<double, int>> predict_topk(const std::vector<int>& context, int k, bool normalize=true) const;
+
+    // Cosine similarity between the embeddings of words `a` and `b`, or 0 if
+    // either embedding is 0
+    // Pre-conditions: 0 <= a, b < W
+    double cosine(int a, int b) const;
+
+    // The `k` words whose embeddings are the most similar to the embedding
+    // of `word` (excluding `word` itself), as (cosine similarity, word index)
+    // pairs sorted descending
+    // Pre-conditions:
+    //   - 0 <= word < W
+    //   - k >= 0
+    std::vector<std::pair<double, int>> nearest(int word, int k) const;
+
+    int W;
+    int D;
+    int historyN;
+    int futureN;
+    QuantizedMatrix P;
+    QuantizedMatrix O;
+    HuffmanTree tree;
+    // Norm of the int8 values of each row of P, for `cosine` and `nearest`;
+    // computed when the model is quantized or loaded, and not saved
+    std::vector<float> norms;
+};
+
+} // namespace toynet
@@ -0,0 +1,183 @@
+#include <toynet/quantized.h>
+#include <toynet/math.h>
+#include <toynet/stlio.h>
+#include <boost/test/unit_test.hpp>
+#include <boost/numeric/ublas/matrix_proxy.hpp>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace toynet;
+
+CBOWModel random_model(int W, int D, unsigned int seed)
+{
+    CBOWModel model(W, D, 2, 2);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> dist(-1.0, 1.0);
+    for (double& x : model.P.data())
+        x = dist(rng);
+    for (double& x : model.O.data())
+        x = dist(rng);
+    return model;
+}
+
+BOOST_AUTO_TEST_CASE(quantize_error)
+{
+    const std::vector<double> x{0.5, -1.27, 0.0, 0.01, 1.0};
+    std::vector<std::int8_t> q(x.size());
+    const float scale = quantize(x.data(), x.size(), q.data());
+    BOOST_CHECK_CLOSE(0.01, scale, 1e-4);
+    BOOST_CHECK_EQUAL(-127, q[1]);
+    for (int i = 0;  i < x.size();  ++i)
+        BOOST_CHECK_SMALL(x[i] - scale * q[i], scale / 2 + 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(quantize_zeros)
+{
+    const std::vector<float> x(3, 0.0f);
+    std::vector<std::int8_t> q(x.size(), 1);
+    BOOST_CHECK_EQUAL(0.0f, quantize(x.data(), x.size(), q.data()));
+    for (std::int8_t v : q)
+        BOOST_CHECK_EQUAL(0, v);
+}
+
+BOOST_AUTO_TEST_CASE(dot_int8_vs_naive)
+{
+    std::mt19937 rng(0);
+    std::uniform_int_distribution<int> dist(-127, 127);
+    for (int n : {0, 1, 7, 8, 9, 100, 1000}) {
+        std::vector<std::int8_t> a(n);
+        std::vector<std::int8_t> b(n);
+        for (int i = 0;  i < n;  ++i) {
+            a[i] = dist(rng);
+            b[i] = dist(rng);
+        }
+        BOOST_CHECK_EQUAL(naive_dot_int8(a.data(), b.data(), n), dot_int8(a.data(), b.data(), n));
+        // worst case: all products are 127 * 127
+        std::fill(a.begin(), a.end(), -127);
+        std::fill(b.begin(), b.end(), -127);
+        BOOST_CHECK_EQUAL(127 * 127 * n, dot_int8(a.data(), b.data(), n));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(QuantizedMatrix_constructor)
+{
+    const CBOWModel model = random_model(5, 7, 0);
+    const QuantizedMatrix q(model.P);
+    BOOST_REQUIRE_EQUAL(5, q.size1());
+    BOOST_REQUIRE_EQUAL(7, q.size2());
+    for (int i = 0;  i < 5;  ++i)
+        for (int j = 0;  j < 7;  ++j)
+            BOOST_CHECK_SMALL(model.P(i, j) - q(i, j), q.scales[i] / 2 + 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(QuantizedCBOWModel_predict)
+{
+    CBOWModel model = random_model(20, 16, 1);
+    const std::vector<std::vector<int>> contexts{{1}, {3, 3, 0}, {19, 4, 7, 12}};
+    for (bool hierarchical : {false, true}) {
+        if (hierarchical)
+            model.set_hierarchical(HuffmanTree(std::vector<long>(20, 1)));
+        const QuantizedCBOWModel q(model);
+        BOOST_CHECK_EQUAL(hierarchical, q.hierarchical());
+        for (const auto& context : contexts) {
+            const auto got = q.predict(context);
+            BOOST_REQUIRE_EQUAL(20, got.size());
+            double sum = 0.0;
+            for (const auto& p : got) {
+                sum += p.first;
+                BOOST_CHECK_SMALL(model.predict(context, p.second) - p.first, 0.02);
+                BOOST_CHECK_CLOSE(q.predict(context, p.second), p.first, 1e-8);
+            }
+            BOOST_CHECK_CLOSE(1.0, sum, 1e-8);
+            const auto top = q.predict_topk(context, 3);
+            BOOST_REQUIRE_EQUAL(3, top.size());
+            for (int i = 0;  i < 3;  ++i) {
+                BOOST_CHECK_EQUAL(got[i].second, top[i].second);
+                BOOST_CHECK_CLOSE(got[i].first, top[i].first, 1e-8);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(QuantizedCBOWModel_cosine_nearest)
+{
+    const CBOWModel model = random_model(30, 32, 2);
+    const QuantizedCBOWModel q(model);
+    for (int a = 0;  a < 30;  a += 7) {
+        for (int b = 0;  b < 30;  b += 5) {
+            const ublas::vector<double> va = ublas::row(model.P, a);
+            const ublas::vector<double> vb = ublas::row(model.P, b);
+            BOOST_CHECK_SMALL(cosine_distance(va, vb) - q.cosine(a, b), 0.02);
+        }
+    }
+    const auto nearest = q.nearest(4, 5);
+    BOOST_REQUIRE_EQUAL(5, nearest.size());
+    for (int i = 0;  i < 5;  ++i) {
+        BOOST_CHECK(nearest[i].second != 4);
+        BOOST_CHECK_EQUAL(q.cosine(4, nearest[i].second), nearest[i].first);
+        if (i > 0)
+            BOOST_CHECK(nearest[i-1].first >= nearest[i].first);
+    }
+    BOOST_CHECK_EQUAL(29, q.nearest(4, 100).size());
+    // A zero embedding is not similar to anything
+    CBOWModel zero = model;
+    ublas::row(zero.P, 3) *= 0.0;
+    const QuantizedCBOWModel qz(zero);
+    BOOST_CHECK_EQUAL(0.0, qz.cosine(3, 4));
+    BOOST_CHECK_EQUAL(0.0, qz.cosine(4, 3));
+}
+
+BOOST_AUTO_TEST_CASE(QuantizedCBOWModel_save_load)
+{
+    CBOWModel model = random_model(6, 4, 3);
+    model.set_hierarchical(HuffmanTree({5, 1, 2, 2, 3, 1}));
+    QuantizedCBOWModel expected(model);
+    std::stringstream ss;
+    expected.save(ss);
+    QuantizedCBOWModel got;
+    got.load(ss);
+    BOOST_CHECK_EQUAL(expected.W, got.W);
+    BOOST_CHECK_EQUAL(expected.D, got.D);
+    BOOST_CHECK_EQUAL(expected.historyN, got.historyN);
+    BOOST_CHECK_EQUAL(expected.futureN, got.futureN);
+    BOOST_CHECK_EQUAL(expected.P.scales, got.P.scales);
+    BOOST_CHECK(expected.P.data == got.P.data);
+    BOOST_CHECK_EQUAL(expected.O.scales, got.O.scales);
+    BOOST_CHECK(expected.O.data == got.O.data);
+    BOOST_CHECK_EQUAL(expected.norms, got.norms);
+    BOOST_CHECK_EQUAL(expected.tree.offsets, got.tree.offsets);
+    BOOST_CHECK_EQUAL(expected.tree.points, got.tree.points);
+    BOOST_CHECK(expected.tree.codes == got.tree.codes);
+    BOOST_CHECK_EQUAL(expected.predict({1, 2}), got.predict({1, 2}));
+    // Sections start on 64-byte boundaries: the header, the 6 scales of P
+    // and the 6 x 4 int8 values of P each take one 64-byte block,
+    // followed by the scales of O
+    const std::string bytes = ss.str();
+    BOOST_CHECK_EQUAL("TOYNETQ8", bytes.substr(0, 8));
+    float scale;
+    std::memcpy(&scale, bytes.data() + 64 + 4, sizeof(scale));
+    BOOST_CHECK_EQUAL(expected.P.scales[1], scale);
+    BOOST_CHECK_EQUAL(expected.P.data[5], std::int8_t(bytes[128 + 5]));
+    std::memcpy(&scale, bytes.data() + 192 + 8, sizeof(scale));
+    BOOST_CHECK_EQUAL(expected.O.scales[2], scale);
+    // Full softmax, and a model overwritten by `load`
+    QuantizedCBOWModel full(random_model(7, 5, 4));
+    std::stringstream ss2;
+    full.save(ss2);
+    got.load(ss2);
+    BOOST_CHECK(!got.hierarchical());
+    BOOST_CHECK_EQUAL(7, got.W);
+    BOOST_CHECK(full.O.data == got.O.data);
+    BOOST_CHECK_EQUAL(full.predict({1, 2}), got.predict({1, 2}));
+    // Errors
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+    BOOST_CHECK_THROW(got.load(truncated), std::runtime_error);
+    // the model is left unchanged
+    BOOST_CHECK_EQUAL(7, got.W);
+    BOOST_CHECK(full.O.data == got.O.data);
+    std::stringstream not_quantized(std::string(100, 'x'));
+    BOOST_CHECK_THROW(got.load(not_quantized), std::runtime_error);
+}
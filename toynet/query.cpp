@@ -0,0 +1,114 @@
+#include <toynet/query.h>
+#include <toynet/math.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace toynet {
+
+namespace {
+
+// Queries are answered in blocks of this many rows, to bound the size of the
+// similarity matrix to query_block x W
+const int query_block = 64;
+
+// Divide the `n` scalars at `x` by their norm, unless they are all zeros
+void normalize_row(float* x, int n)
+{
+    double sum = 0.0;
+    for (int j = 0;  j < n;  ++j)
+        sum += double(x[j]) * x[j];
+    if (sum == 0.0)
+        return;
+    const float inv = 1.0 / std::sqrt(sum);
+    for (int j = 0;  j < n;  ++j)
+        x[j] *= inv;
+}
+
+template<class T>
+AlignedMatrix<float> normalize_rows(const BasicEmbeddingMatrix<T>& points)
+{
+    AlignedMatrix<float> ret(points.size1(), points.size2());
+    for (int i = 0;  i < ret.size1();  ++i) {
+        for (int j = 0;  j < ret.size2();  ++j)
+            ret(i, j) = points(i, j);
+        normalize_row(&ret(i, 0), ret.size2());
+    }
+    return ret;
+}
+
+} // namespace
+
+QueryEngine::QueryEngine(const BasicEmbeddingMatrix<double>& points)
+    : normalized(normalize_rows(points))
+{
+}
+
+QueryEngine::QueryEngine(const BasicEmbeddingMatrix<float>& points)
+    : normalized(normalize_rows(points))
+{
+}
+
+std::vector<std::vector<std::pair<double, int>>> QueryEngine::search(const ublas::matrix<float>& queries, int k,
+                                                                     const std::vector<std::vector<int>>& exclude) const
+{
+    const int W = normalized.size1();
+    const int D = normalized.size2();
+    const int B = queries.size1();
+    std::vector<std::vector<std::pair<double, int>>> ret(B);
+    if (B == 0)
+        return ret;
+    AlignedMatrix<float> block(std::min(B, query_block), D);
+    AlignedMatrix<float> scores(block.size1(), W);
+    for (int first = 0;  first < B;  first += query_block) {
+        const int n = std::min(query_block, B - first);
+        for (int b = 0;  b < n;  ++b) {
+            std::copy_n(&queries(first + b, 0), D, &block(b, 0));
+            normalize_row(&block(b, 0), D);
+        }
+        prod_trans(&block(0, 0), &normalized(0, 0), &scores(0, 0), n, W, D);
+        for (int b = 0;  b < n;  ++b) {
+            float* row = &scores(b, 0);
+            if (!exclude.empty()) {
+                // -inf sorts below any similarity, and is then dropped
+                for (int i : exclude[first + b])
+                    row[i] = -std::numeric_limits<float>::infinity();
+            }
+            TopK top(std::min(k, W));
+            for (int i = 0;  i < W;  ++i)
+                top.push(row[i], i);
+            std::vector<std::pair<double, int>>& got = ret[first + b];
+            got = top.sorted();
+            while (!got.empty() && got.back().first == -std::numeric_limits<float>::infinity())
+                got.pop_back();
+        }
+    }
+    return ret;
+}
+
+std::vector<std::vector<std::pair<double, int>>> QueryEngine::similar(const std::vector<int>& points, int k) const
+{
+    ublas::matrix<float> queries(points.size(), normalized.size2());
+    std::vector<std::vector<int>> exclude(points.size());
+    for (int b = 0;  b < points.size();  ++b) {
+        std::copy_n(&normalized(points[b], 0), queries.size2(), &queries(b, 0));
+        exclude[b] = {points[b]};
+    }
+    return search(queries, k, exclude);
+}
+
+std::vector<std::vector<std::pair<double, int>>> QueryEngine::analogies(const std::vector<Analogy>& queries, int k) const
+{
+    const int D = normalized.size2();
+    ublas::matrix<float> q(queries.size(), D);
+    std::vector<std::vector<int>> exclude(queries.size());
+    for (int b = 0;  b < queries.size();  ++b) {
+        const Analogy& a = queries[b];
+        for (int j = 0;  j < D;  ++j)
+            q(b, j) = normalized(a.a, j) - normalized(a.b, j) + normalized(a.c, j);
+        exclude[b] = {a.a, a.b, a.c};
+    }
+    return search(q, k, exclude);
+}
+
+} // namespace toynet
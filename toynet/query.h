@@ -0,0 +1,59 @@
+#include <toynet/w2v.h>
+#include <toynet/ublas/aligned_allocator.h>
+#include <utility>
+#include <vector>
+#include <boost/numeric/ublas/matrix.hpp>
+
+namespace toynet {
+
+// An analogy query "a is to b as c is to ?", answered with the words most
+// similar to a - b + c (https://arxiv.org/abs/1301.3781), e.g.
+// {"king", "man", "woman"} for "queen".  Words are indices of the embeddings.
+struct Analogy {
+    int a;
+    int b;
+    int c;
+};
+
+// Exact cosine similarity queries over a set of embeddings, e.g.
+// `CBOWModel::P`, answered in batches.  The rows are normalized once into a
+// contiguous, 64-byte aligned float matrix, so that the cosine similarities
+// of a whole batch of queries are a single matrix product (see
+// `prod_trans`), followed by a bounded top-k selection per query (see
+// `TopK`) instead of a full sort.
+// For approximate queries in sublinear time, see `HNSWIndex`.
+struct QueryEngine {
+    // Pre-conditions: points.size1() > 0
+    explicit QueryEngine(const BasicEmbeddingMatrix<double>& points);
+
+    explicit QueryEngine(const BasicEmbeddingMatrix<float>& points);
+
+    // The number of points
+    int size() const { return normalized.size1(); }
+
+    // For each row of `queries`, the `k` most similar points as (cosine
+    // similarity, point index) pairs sorted descending, leaving out the
+    // points in `exclude[b]` for query `b`, if `exclude` is not empty.
+    // Pre-conditions:
+    //   - queries.size2() == the dimension of the points
+    //   - exclude.empty() || exclude.size() == queries.size1()
+    //   - k >= 0
+    std::vector<std::vector<std::pair<double, int>>> search(const ublas::matrix<float>& queries, int k,
+                                                            const std::vector<std::vector<int>>& exclude={}) const;
+
+    // For each point of `points`, the `k` most similar other points
+    // Pre-conditions: for each `i` in `points`: 0 <= `i` < size()
+    std::vector<std::vector<std::pair<double, int>>> similar(const std::vector<int>& points, int k) const;
+
+    // For each analogy, the `k` points most similar to a - b + c (computed
+    // from the normalized points), other than a, b and c
+    // Pre-conditions: for each point of each analogy: 0 <= point < size()
+    std::vector<std::vector<std::pair<double, int>>> analogies(const std::vector<Analogy>& queries, int k) const;
+
+    // The points divided by their norms; rows of zeros stay zeros.  The
+    // rows are contiguous, and the first one starts on a 64-byte boundary
+    // (see `AlignedMatrix`), also in copies of the engine.
+    AlignedMatrix<float> normalized;
+};
+
+} // namespace toynet
@@ -0,0 +1,113 @@
+#include <toynet/query.h>
+#include <toynet/math.h>
+#include <toynet/stlio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+namespace {
+
+EmbeddingMatrix random_points(int W, int D, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> dist;
+    EmbeddingMatrix ret(W, D);
+    for (double& x : ret.data())
+        x = dist(rng);
+    return ret;
+}
+
+ublas::vector<double> point(const EmbeddingMatrix& points, int i)
+{
+    ublas::vector<double> ret(points.size2());
+    for (int j = 0;  j < ret.size();  ++j)
+        ret[j] = points(i, j);
+    return ret;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(QueryEngine_similar)
+{
+    // More points than a block of queries
+    const EmbeddingMatrix points = random_points(100, 8, 1);
+    const QueryEngine engine(points);
+    BOOST_CHECK_EQUAL(100, engine.size());
+    std::vector<int> queries(points.size1());
+    for (int i = 0;  i < queries.size();  ++i)
+        queries[i] = i;
+    const auto got = engine.similar(queries, 5);
+    BOOST_REQUIRE_EQUAL(100, got.size());
+    for (int q = 0;  q < queries.size();  ++q) {
+        std::vector<std::pair<double, int>> expected;
+        for (int i = 0;  i < points.size1();  ++i)
+            if (i != q)
+                expected.emplace_back(cosine_distance(point(points, q), point(points, i)), i);
+        std::sort(expected.begin(), expected.end(), std::greater<>());
+        BOOST_REQUIRE_EQUAL(5, got[q].size());
+        for (int r = 0;  r < 5;  ++r) {
+            BOOST_CHECK_EQUAL(expected[r].second, got[q][r].second);
+            BOOST_CHECK_CLOSE(expected[r].first, got[q][r].first, 1e-3);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(QueryEngine_aligned)
+{
+    const EmbeddingMatrix points = random_points(7, 5, 3);
+    const QueryEngine engine(points);
+    const QueryEngine copy = engine;
+    BOOST_CHECK_EQUAL(0, reinterpret_cast<std::uintptr_t>(&engine.normalized.data()[0]) % 64);
+    BOOST_CHECK_EQUAL(0, reinterpret_cast<std::uintptr_t>(&copy.normalized.data()[0]) % 64);
+    BOOST_CHECK(std::equal(engine.normalized.data().begin(), engine.normalized.data().end(),
+                           copy.normalized.data().begin()));
+}
+
+BOOST_AUTO_TEST_CASE(QueryEngine_search)
+{
+    EmbeddingMatrix points(3, 2);
+    points(0, 0) = 2.0;  points(0, 1) = 0.0;
+    points(1, 0) = 0.0;  points(1, 1) = 3.0;
+    points(2, 0) = 0.0;  points(2, 1) = 0.0;
+    const QueryEngine engine(points);
+    ublas::matrix<float> queries(1, 2);
+    queries(0, 0) = 1.0f;
+    queries(0, 1) = 1.0f;
+    const auto got = engine.search(queries, 10);
+    BOOST_REQUIRE_EQUAL(1, got.size());
+    BOOST_REQUIRE_EQUAL(3, got[0].size());
+    BOOST_CHECK_CLOSE(std::sqrt(0.5), got[0][0].first, 1e-4);
+    BOOST_CHECK_EQUAL(0.0, got[0][2].first);  // a zero point is orthogonal to everything
+    BOOST_CHECK_EQUAL(2, got[0][2].second);
+    const auto excluded = engine.search(queries, 10, {{0, 2}});
+    BOOST_REQUIRE_EQUAL(1, excluded[0].size());
+    BOOST_CHECK_EQUAL(1, excluded[0][0].second);
+    BOOST_CHECK(engine.search(ublas::matrix<float>(0, 2), 3).empty());
+}
+
+BOOST_AUTO_TEST_CASE(QueryEngine_analogies)
+{
+    // Points on two axes: gender (x) and royalty (y)
+    FloatCBOWModel model(5, 2);
+    const float coords[5][2] = {
+        {1.0f, 1.0f},    // 0: king
+        {1.0f, 0.0f},    // 1: man
+        {-1.0f, 0.0f},   // 2: woman
+        {-1.0f, 1.0f},   // 3: queen
+        {0.0f, -1.0f},   // 4: peasant
+    };
+    for (int i = 0;  i < 5;  ++i)
+        for (int j = 0;  j < 2;  ++j)
+            model.P(i, j) = coords[i][j];
+    const QueryEngine engine(model.P);
+    const auto got = engine.analogies({{0, 1, 2}, {3, 2, 1}}, 1);
+    BOOST_REQUIRE_EQUAL(2, got.size());
+    BOOST_REQUIRE_EQUAL(1, got[0].size());
+    BOOST_CHECK_EQUAL(3, got[0][0].second);  // king - man + woman = queen
+    BOOST_CHECK_EQUAL(0, got[1][0].second);  // queen - woman + man = king
+}
@@ -0,0 +1,57 @@
+#include <toynet/sampling.h>
+#include <cmath>
+
+namespace toynet {
+
+AliasSampler::AliasSampler(const std::vector<double>& weights)
+    : prob(weights.size())
+    , alias(weights.size())
+{
+    const int n = weights.size();
+    double sum = 0.0;
+    for (double w : weights)
+        sum += w;
+    // Scale the weights so that the average bucket has probability 1, then
+    // pair each under-full bucket with an over-full one.
+    std::vector<double> scaled(n);
+    std::vector<int> small;
+    std::vector<int> large;
+    for (int i = 0;  i < n;  ++i) {
+        scaled[i] = weights[i] * n / sum;
+        if (scaled[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const int s = small.back();
+        small.pop_back();
+        const int l = large.back();
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Leftovers are full buckets, up to rounding errors
+    for (int i : large) {
+        prob[i] = 1.0;
+        alias[i] = i;
+    }
+    for (int i : small) {
+        prob[i] = 1.0;
+        alias[i] = i;
+    }
+}
+
+std::vector<double> unigram_distribution(const std::vector<long>& counts, double power)
+{
+    std::vector<double> ret(counts.size());
+    for (int i = 0;  i < counts.size();  ++i)
+        ret[i] = std::pow(static_cast<double>(counts[i]), power);
+    return ret;
+}
+
+} // namespace toynet
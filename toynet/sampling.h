@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace toynet {
+
+// Draws integers from a fixed discrete distribution in O(1) time per sample,
+// using Vose's alias method (https://www.keithschwarz.com/darts-dice-coins/).
+struct AliasSampler {
+    AliasSampler() = default;
+
+    // Build a sampler that returns `i` with probability
+    // weights[i] / sum(weights).
+    // Pre-conditions:
+    // - weights.size() > 0
+    // - For each `w` in `weights`: w >= 0
+    // - sum(weights) > 0
+    explicit AliasSampler(const std::vector<double>& weights);
+
+    // The number of possible outcomes
+    int size() const { return prob.size(); }
+
+    // Draw one sample in [0, size())
+    template<class RNG>
+    int operator()(RNG& rng) const
+    {
+        std::uniform_real_distribution<double> dist(0.0, prob.size());
+        const double x = dist(rng);
+        const int i = std::min<int>(x, prob.size() - 1);
+        return (x - i < prob[i]) ? i : alias[i];
+    }
+
+    // prob[i]: the probability of keeping `i` when bucket `i` is drawn
+    std::vector<double> prob;
+    // alias[i]: the outcome returned when bucket `i` is drawn but not kept
+    std::vector<int> alias;
+};
+
+// The noise distribution of negative sampling (https://arxiv.org/abs/1310.4546):
+// the unigram distribution raised to the power `power`.
+// Return value: a list of (unnormalized) weights, ret[w] = counts[w] ^ power
+std::vector<double> unigram_distribution(const std::vector<long>& counts, double power=0.75);
+
+} // namespace toynet
@@ -0,0 +1,44 @@
+#include <toynet/sampling.h>
+#include <toynet/stlio.h>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+BOOST_AUTO_TEST_CASE(AliasSampler_size_1)
+{
+    AliasSampler sampler({0.3});
+    std::mt19937 rng(0);
+    BOOST_CHECK_EQUAL(1, sampler.size());
+    for (int i = 0;  i < 100;  ++i)
+        BOOST_CHECK_EQUAL(0, sampler(rng));
+}
+
+BOOST_AUTO_TEST_CASE(AliasSampler_zero_weight)
+{
+    AliasSampler sampler({1.0, 0.0, 3.0});
+    std::mt19937 rng(0);
+    for (int i = 0;  i < 1000;  ++i)
+        BOOST_CHECK(sampler(rng) != 1);
+}
+
+BOOST_AUTO_TEST_CASE(AliasSampler_distribution)
+{
+    const std::vector<double> weights{1.0, 2.0, 3.0, 4.0, 0.5, 9.5};
+    AliasSampler sampler(weights);
+    std::mt19937 rng(0);
+    const int N = 200000;
+    std::vector<int> counts(weights.size(), 0);
+    for (int i = 0;  i < N;  ++i)
+        ++counts[sampler(rng)];
+    for (int i = 0;  i < weights.size();  ++i)
+        BOOST_CHECK_CLOSE(weights[i] / 20.0, counts[i] / double(N), 3.0);
+}
+
+BOOST_AUTO_TEST_CASE(unigram_distribution_3)
+{
+    const std::vector<double> got = unigram_distribution({16, 0, 1});
+    BOOST_REQUIRE_EQUAL(3, got.size());
+    BOOST_CHECK_CLOSE(8.0, got[0], 1e-12);
+    BOOST_CHECK_EQUAL(0.0, got[1]);
+    BOOST_CHECK_CLOSE(1.0, got[2], 1e-12);
+}
@@ -0,0 +1,73 @@
+#include <toynet/ublas/ublas.h>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <utility>
+#include <boost/numeric/ublas/matrix.hpp>
+#include <boost/numeric/ublas/storage.hpp>
+
+namespace toynet {
+
+// An allocator whose allocations start on an `Alignment`-byte boundary, e.g.
+// a cache line.  Copies of a container made with it are aligned too.
+template<class T, std::size_t Alignment=64>
+struct AlignedAllocator {
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+
+    template<class U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    static constexpr std::size_t alignment = Alignment;
+
+    AlignedAllocator() {}
+
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_type n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, size_type)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    // ublas storage constructs and destroys elements through its allocator
+    template<class U, class... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template<class U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+
+    size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(T); }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// A row-major ublas matrix whose elements start on a 64-byte boundary.  The
+// rows are contiguous, so only the first one is aligned unless size2() is a
+// multiple of 64 / sizeof(T).
+template<class T>
+using AlignedMatrix = ublas::matrix<T, ublas::row_major, ublas::unbounded_array<T, AlignedAllocator<T>>>;
+
+} // namespace toynet
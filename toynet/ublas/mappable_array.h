@@ -0,0 +1,145 @@
+#include <toynet/ublas/ublas.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include <boost/numeric/ublas/storage.hpp>
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/collection_size_type.hpp>
+#include <boost/serialization/nvp.hpp>
+
+namespace toynet {
+
+// A ublas storage array, like `ublas::unbounded_array`, that either owns its
+// elements or refers to elements owned by someone else, e.g. a memory-mapped
+// file.  This lets a `ublas::matrix` be used in place over external memory.
+// Copies and resized arrays always own their elements; moves and swaps keep
+// referring to the same memory.
+template<class T>
+class MappableArray : public ublas::storage_array<MappableArray<T>> {
+  public:
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T value_type;
+    typedef const T& const_reference;
+    typedef T& reference;
+    typedef const T* const_pointer;
+    typedef T* pointer;
+    typedef const_pointer const_iterator;
+    typedef pointer iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+
+    MappableArray() : data_(nullptr), size_(0) {}
+
+    explicit MappableArray(size_type size)
+        : owned_(size), data_(owned_.data()), size_(size) {}
+
+    MappableArray(size_type size, const value_type& init)
+        : owned_(size, init), data_(owned_.data()), size_(size) {}
+
+    // Refer to the `size` elements at `data`.  `keepalive` owns the memory
+    // and is released when it is no longer referred to.
+    MappableArray(size_type size, pointer data, std::shared_ptr<void> keepalive)
+        : data_(data), size_(size), keepalive_(std::move(keepalive)) {}
+
+    MappableArray(const MappableArray& other)
+        : owned_(other.begin(), other.end()), data_(owned_.data()), size_(other.size_) {}
+
+    MappableArray(MappableArray&& other) noexcept
+        : MappableArray()
+    {
+        swap(other);
+    }
+
+    MappableArray& operator=(const MappableArray& other)
+    {
+        if (this != &other) {
+            resize(other.size_);
+            std::copy(other.begin(), other.end(), begin());
+        }
+        return *this;
+    }
+
+    MappableArray& operator=(MappableArray&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    // Whether the elements are owned by someone else
+    bool mapped() const { return keepalive_ != nullptr; }
+
+    // Resizing to a different size always copies the elements (up to the
+    // new size) to owned memory
+    void resize(size_type size)
+    {
+        if (size != size_)
+            own(size, value_type());
+    }
+
+    void resize(size_type size, value_type init)
+    {
+        if (size != size_)
+            own(size, init);
+    }
+
+    size_type size() const { return size_; }
+    size_type max_size() const { return owned_.max_size(); }
+    bool empty() const { return size_ == 0; }
+
+    const_reference operator[](size_type i) const { return data_[i]; }
+    reference operator[](size_type i) { return data_[i]; }
+
+    void swap(MappableArray& other)
+    {
+        if (this != &other) {
+            owned_.swap(other.owned_);
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+            keepalive_.swap(other.keepalive_);
+        }
+    }
+
+    friend void swap(MappableArray& a, MappableArray& b) { a.swap(b); }
+
+    const_iterator begin() const { return data_; }
+    const_iterator cbegin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+    const_iterator cend() const { return data_ + size_; }
+    iterator begin() { return data_; }
+    iterator end() { return data_ + size_; }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+
+    // Same layout as `ublas::unbounded_array`
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        boost::serialization::collection_size_type s(size_);
+        ar & boost::serialization::make_nvp("size", s);
+        if (Archive::is_loading::value)
+            resize(s);
+        ar & boost::serialization::make_array(data_, s);
+    }
+
+  private:
+    void own(size_type size, const value_type& init)
+    {
+        std::vector<T> owned(size, init);
+        std::copy(data_, data_ + std::min(size, size_), owned.begin());
+        owned_.swap(owned);
+        data_ = owned_.data();
+        size_ = size;
+        keepalive_.reset();
+    }
+
+    std::vector<T> owned_;
+    pointer data_;
+    size_type size_;
+    std::shared_ptr<void> keepalive_;
+};
+
+} // namespace toynet
@@ -0,0 +1,73 @@
+#include <toynet/vocab.h>
+#include <toynet/corpus.h>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/archive/text_iarchive.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace toynet {
+
+Vocabulary::Vocabulary(const std::vector<long>& counts, long minCount)
+    : words(counts.size(), -1)
+{
+    for (int id = 0;  id < counts.size();  ++id)
+        if (counts[id] >= minCount)
+            ids.push_back(id);
+    std::stable_sort(ids.begin(), ids.end(), [&counts](int a, int b) {
+        return counts[a] > counts[b];
+    });
+    this->counts.resize(ids.size());
+    for (int w = 0;  w < ids.size();  ++w) {
+        words[ids[w]] = w;
+        this->counts[w] = counts[ids[w]];
+    }
+}
+
+std::vector<int> Vocabulary::apply(const Corpus& corpus) const
+{
+    std::vector<int> ret;
+    for (std::size_t i = 0;  i < corpus.size();  ++i) {
+        const int w = word(corpus[i]);
+        if (w >= 0)
+            ret.push_back(w);
+    }
+    return ret;
+}
+
+void Vocabulary::apply(const Corpus& corpus, CorpusWriter& out) const
+{
+    for (std::size_t i = 0;  i < corpus.size();  ++i) {
+        const int w = word(corpus[i]);
+        if (w >= 0)
+            out.write(w);
+    }
+}
+
+void Vocabulary::save(std::ostream& os) const
+{
+    boost::archive::text_oarchive oa(os);
+    oa << *this;
+}
+
+void Vocabulary::load(std::istream& is)
+{
+    boost::archive::text_iarchive ia(is);
+    ia >> *this;
+}
+
+std::vector<double> keep_probabilities(const std::vector<long>& counts, double sample)
+{
+    double total = 0.0;
+    for (long c : counts)
+        total += c;
+    std::vector<double> ret(counts.size(), 1.0);
+    for (int w = 0;  w < counts.size();  ++w) {
+        if (counts[w] == 0)
+            continue;
+        const double f = counts[w] / total;
+        ret[w] = std::min(1.0, (std::sqrt(f / sample) + 1.0) * sample / f);
+    }
+    return ret;
+}
+
+} // namespace toynet
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <vector>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace toynet {
+
+struct Corpus;
+struct CorpusWriter;
+
+// The vocabulary of a corpus: maps the word indices of the corpus ("ids")
+// to the word indices of a model ("words").  Ids that appear fewer than
+// `minCount` times are dropped, and the remaining ones are numbered by
+// descending frequency, so that word 0 is the most frequent one.  Besides
+// shrinking W, this puts the rows of P and O of the most frequent words next
+// to each other in memory.
+struct Vocabulary {
+    Vocabulary() = default;
+
+    // Build a vocabulary from the number of occurrences of each id, e.g.
+    // `Corpus::counts`.  Ties are broken by increasing id.
+    // Pre-conditions: minCount >= 1
+    explicit Vocabulary(const std::vector<long>& counts, long minCount=1);
+
+    // The number of words, i.e. W
+    int size() const { return ids.size(); }
+
+    // The word index of `id`, or -1 if `id` was dropped or never seen
+    int word(int id) const { return id >= 0 && id < words.size() ? words[id] : -1; }
+
+    // Map the ids of `corpus` to word indices, dropping the ids that are not
+    // in the vocabulary
+    std::vector<int> apply(const Corpus& corpus) const;
+
+    // Like the previous `apply` function, but write the words to `out`, so
+    // that the result never has to be in memory
+    void apply(const Corpus& corpus, CorpusWriter& out) const;
+
+    // Save the vocabulary to an output stream using Boost serialization
+    void save(std::ostream& os) const;
+
+    // Load a vocabulary from an input stream using Boost serialization
+    void load(std::istream& is);
+
+    friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & words;
+        ar & ids;
+        ar & counts;
+    }
+
+    // words[id] is the word index of `id`, or -1
+    std::vector<int> words;
+    // ids[w] is the id of word `w`
+    std::vector<int> ids;
+    // counts[w] is the number of occurrences of word `w`
+    std::vector<long> counts;
+};
+
+// The probability of keeping each occurrence of each word when subsampling
+// frequent words (https://arxiv.org/abs/1310.4546), with the formula of the
+// word2vec implementation: a word of frequency f = counts[w] / sum(counts) is
+// kept with probability min(1, (sqrt(f / sample) + 1) * sample / f).  Words
+// much more frequent than `sample` are mostly discarded, which speeds up
+// training and improves the embeddings of rare words.
+// Pre-conditions: sample > 0
+std::vector<double> keep_probabilities(const std::vector<long>& counts, double sample);
+
+} // namespace toynet
@@ -0,0 +1,83 @@
+#include <toynet/vocab.h>
+#include <toynet/corpus.h>
+#include <toynet/stlio.h>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+BOOST_AUTO_TEST_CASE(Vocabulary_default)
+{
+    const Vocabulary vocab;
+    BOOST_CHECK_EQUAL(0, vocab.size());
+    BOOST_CHECK_EQUAL(-1, vocab.word(0));
+}
+
+BOOST_AUTO_TEST_CASE(Vocabulary_constructor)
+{
+    // ids 1 and 4 are tied, id 2 is never seen
+    const Vocabulary vocab({3, 5, 0, 1, 5, 2});
+    BOOST_CHECK_EQUAL(5, vocab.size());
+    BOOST_CHECK_EQUAL(std::vector<int>({1, 4, 0, 5, 3}), vocab.ids);
+    BOOST_CHECK_EQUAL(std::vector<long>({5, 5, 3, 2, 1}), vocab.counts);
+    BOOST_CHECK_EQUAL(std::vector<int>({2, 0, -1, 4, 1, 3}), vocab.words);
+    BOOST_CHECK_EQUAL(-1, vocab.word(6));
+    BOOST_CHECK_EQUAL(-1, vocab.word(-1));
+}
+
+BOOST_AUTO_TEST_CASE(Vocabulary_min_count)
+{
+    const Vocabulary vocab({3, 5, 0, 1, 5, 2}, 3);
+    BOOST_CHECK_EQUAL(3, vocab.size());
+    BOOST_CHECK_EQUAL(std::vector<int>({1, 4, 0}), vocab.ids);
+    BOOST_CHECK_EQUAL(-1, vocab.word(5));
+    BOOST_CHECK_EQUAL(2, vocab.word(0));
+}
+
+BOOST_AUTO_TEST_CASE(Vocabulary_apply)
+{
+    const std::vector<int> ids{4, 1, 1, 0, 4, 2, 1};
+    const Corpus corpus(ids);
+    const Vocabulary vocab(corpus.counts, 2);
+    const std::vector<int> expected{1, 0, 0, 1, 0};
+    BOOST_CHECK_EQUAL(expected, vocab.apply(corpus));
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Vocabulary_apply").string();
+    {
+        CorpusWriter writer(path);
+        vocab.apply(corpus, writer);
+    }
+    const Corpus mapped(path);
+    std::remove(path.c_str());
+    BOOST_REQUIRE_EQUAL(expected.size(), mapped.size());
+    for (int i = 0;  i < expected.size();  ++i)
+        BOOST_CHECK_EQUAL(expected[i], mapped[i]);
+    BOOST_CHECK_EQUAL(vocab.counts, mapped.counts);
+}
+
+BOOST_AUTO_TEST_CASE(Vocabulary_save_load)
+{
+    const Vocabulary expected({3, 5, 0, 1, 5, 2}, 2);
+    std::stringstream ss;
+    expected.save(ss);
+    Vocabulary got;
+    got.load(ss);
+    BOOST_CHECK_EQUAL(expected.words, got.words);
+    BOOST_CHECK_EQUAL(expected.ids, got.ids);
+    BOOST_CHECK_EQUAL(expected.counts, got.counts);
+}
+
+BOOST_AUTO_TEST_CASE(keep_probabilities_formula)
+{
+    // frequencies 0.5, 0.25, 0.25 and 0
+    const std::vector<double> keep = keep_probabilities({2, 1, 1, 0}, 0.01);
+    BOOST_REQUIRE_EQUAL(4, keep.size());
+    BOOST_CHECK_CLOSE((std::sqrt(50.0) + 1) * 0.02, keep[0], 1e-10);
+    BOOST_CHECK_CLOSE((std::sqrt(25.0) + 1) * 0.04, keep[1], 1e-10);
+    BOOST_CHECK_EQUAL(keep[1], keep[2]);
+    BOOST_CHECK_EQUAL(1.0, keep[3]);
+    // rare words are always kept
+    BOOST_CHECK_EQUAL(1.0, keep_probabilities({1, 1000000}, 0.01)[0]);
+}
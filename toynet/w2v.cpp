@@ -1,33 +1,643 @@
 #include <toynet/w2v.h>
+#include <toynet/blas.h>
+#include <toynet/mapped_file.h>
 #include <toynet/math.h>
+#include <toynet/sampling.h>
+#include <toynet/vocab.h>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/numeric/ublas/matrix_proxy.hpp>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 namespace toynet {
 
+namespace {
+
+// Pointer to the first element of row `i` of a row-major matrix
+template<class Matrix>
+typename Matrix::value_type* row_ptr(Matrix& m, int i)
+{
+    return &m.data()[0] + i * m.size2();
+}
+
+template<class Matrix>
+const typename Matrix::value_type* row_ptr(const Matrix& m, int i)
+{
+    return &m.data()[0] + i * m.size2();
+}
+
+template<class T>
+T dot(const T* a, const T* b, int n)
+{
+    return simd_dot(a, b, n);
+}
+
+// out[i] += a * x[i]
+template<class T, class U>
+void axpy(double a, const T* x, U* out, int n)
+{
+    const U b = a;
+    for (int i = 0;  i < n;  ++i)
+        out[i] += b * x[i];
+}
+
+// Average of the embeddings of the context words
+// Pre-condition: !context.empty()
+template<class T>
+void context_average(const BasicEmbeddingMatrix<T>& P, const std::vector<int>& context, ublas::vector<T>& h)
+{
+    const int D = P.size2();
+    std::fill(h.begin(), h.end(), T(0));
+    for (int wordidx : context)
+        axpy(1.0, row_ptr(P, wordidx), &h[0], D);
+    const T n = context.size();
+    for (int i = 0;  i < D;  ++i)
+        h[i] /= n;
+}
+
+// out[i] = dot(row i of O, avg) for i in [0, n), in double precision whatever
+// the type of the model
+void output_logits(const BasicEmbeddingMatrix<double>& O, const double* avg, int n, double* out)
+{
+    gemv(Trans::no, n, O.size2(), 1.0, row_ptr(O, 0), O.size2(), avg, 0.0, out);
+}
+
+void output_logits(const BasicEmbeddingMatrix<float>& O, const float* avg, int n, double* out)
+{
+    std::vector<float> x(n);
+    gemv(Trans::no, n, O.size2(), 1.0f, row_ptr(O, 0), O.size2(), avg, 0.0f, x.data());
+    std::copy(x.begin(), x.end(), out);
+}
+
+// Probability of each word given the logits `x` of the W - 1 inner nodes of
+// a hierarchical softmax
+template<class T, class U>
+void tree_probabilities(const HuffmanTree& tree, const T* x, U* out)
+{
+    const int W = tree.size();
+    for (int w = 0;  w < W;  ++w) {
+        double p = 1.0;
+        for (int j = tree.offsets[w];  j < tree.offsets[w+1];  ++j) {
+            const double left = sigmoid(x[tree.points[j]]);
+            p *= tree.codes[j] ? 1.0 - left : left;
+        }
+        out[w] = p;
+    }
+}
+
+// See `CBOWModel::save_binary`
+struct BinaryHeader {
+    char magic[8];
+    std::int32_t version;
+    std::int32_t scalar_size;
+    std::int32_t W;
+    std::int32_t D;
+    std::int32_t historyN;
+    std::int32_t futureN;
+    std::int64_t tree_points;
+    char reserved[24];
+};
+
+static_assert(sizeof(BinaryHeader) == 64, "BinaryHeader must be 64 bytes");
+
+const char binary_magic[8] = {'T', 'O', 'Y', 'N', 'E', 'T', 'W', '2'};
+const int binary_version = 1;
+const std::size_t binary_alignment = 64;
+
+std::size_t align_up(std::size_t n)
+{
+    return (n + binary_alignment - 1) / binary_alignment * binary_alignment;
+}
+
+// Byte offsets of each section of the binary format
+struct BinaryLayout {
+    explicit BinaryLayout(const BinaryHeader& h)
+        : P(sizeof(BinaryHeader))
+        , O(align_up(P + std::size_t(h.W) * h.D * h.scalar_size))
+        , tree(align_up(O + std::size_t(h.W) * h.D * h.scalar_size))
+        , end(tree + (h.tree_points > 0 ? (h.W + 1 + h.tree_points) * 4 + h.tree_points : 0))
+    {
+    }
+    std::size_t P;
+    std::size_t O;
+    std::size_t tree;
+    std::size_t end;
+};
+
+void check_header(const BinaryHeader& h, int scalar_size)
+{
+    if (std::memcmp(h.magic, binary_magic, sizeof(binary_magic)) != 0)
+        throw std::runtime_error("CBOWModel: not a binary model");
+    if (h.version != binary_version)
+        throw std::runtime_error("CBOWModel: unsupported binary model version " + std::to_string(h.version));
+    if (h.scalar_size != scalar_size)
+        throw std::runtime_error("CBOWModel: unsupported scalar size " + std::to_string(h.scalar_size));
+    if (h.W <= 0 || h.D <= 0 || h.tree_points < 0)
+        throw std::runtime_error("CBOWModel: corrupted binary model header");
+}
+
+// Whether all the word indices of `corpus` are in [0, corpus.W)
+bool in_vocabulary(const Corpus& corpus)
+{
+    for (std::size_t i = 0;  i < corpus.size();  ++i)
+        if (corpus.words[i] >= std::uint32_t(corpus.W))
+            return false;
+    return true;
+}
+
+// Read `n` bytes to `data` from offset `offset` of a stream that is at offset
+// `pos`, skipping the padding in between
+void read_section(std::istream& is, std::size_t& pos, std::size_t offset, void* data, std::size_t n)
+{
+    if (!is.ignore(offset - pos) || !is.read(static_cast<char*>(data), n))
+        throw std::runtime_error("CBOWModel: truncated binary model");
+    pos = offset + n;
+}
+
+// Read the tree section of the binary format
+void read_tree(HuffmanTree& tree, const BinaryHeader& h, const char* data)
+{
+    tree = HuffmanTree();
+    if (h.tree_points == 0)
+        return;
+    tree.offsets.resize(h.W + 1);
+    tree.points.resize(h.tree_points);
+    tree.codes.resize(h.tree_points);
+    std::memcpy(tree.offsets.data(), data, tree.offsets.size() * 4);
+    data += tree.offsets.size() * 4;
+    std::memcpy(tree.points.data(), data, tree.points.size() * 4);
+    data += tree.points.size() * 4;
+    std::memcpy(tree.codes.data(), data, tree.codes.size());
+}
+
+// log(sigmoid(x)), without overflowing exp()
+double log_sigmoid(double x)
+{
+    return x >= 0.0 ? -std::log1p(std::exp(-x)) : x - std::log1p(std::exp(x));
+}
+
+// log(p(word | context)) given the average embedding `avg` of the context.
+// `out` is scratch space of size W for the output layer.
+template<class T>
+double log_prob(const BasicCBOWModel<T>& model, const T* avg, int word, double* out)
+{
+    const HuffmanTree& tree = model.tree;
+    const int D = model.D;
+    if (model.hierarchical()) {
+        double ret = 0.0;
+        for (int j = tree.offsets[word];  j < tree.offsets[word+1];  ++j) {
+            const double x = dot(avg, row_ptr(model.O, tree.points[j]), D);
+            ret += log_sigmoid(tree.codes[j] ? -x : x);
+        }
+        return ret;
+    }
+    // log(softmax(out)[word]) = out[word] - logsumexp(out)
+    for (int k = 0;  k < model.W;  ++k)
+        out[k] = dot(avg, row_ptr(model.O, k), D);
+    return out[word] - logsumexp(out, model.W);
+}
+
+// Sum of log(p(words[i] | context)) for i in [begin, end).
+// Instead of building each context, keep the running sum of the context
+// embeddings as the window slides: when moving from `i` to `i + 1`, the
+// oldest history word and `words[i+1]` leave the context, while `words[i]`
+// and the next future word enter it.
+// The running sum is kept in double precision whatever the type of the model,
+// so that rounding errors do not accumulate as words enter and leave it.
+template<class Scalar, class Words>
+double sum_log_prob(const BasicCBOWModel<Scalar>& model, const Words& words, long begin, long end)
+{
+    const long T = words.size();
+    const int D = model.D;
+    const int historyN = model.historyN;
+    const int futureN = model.futureN;
+    std::vector<double> sum(D, 0.0);
+    std::vector<Scalar> avg(D);
+    std::vector<double> out(model.W);
+    int n = 0;  // number of words in the context
+    auto add = [&](long j, double sign) {
+        axpy(sign, row_ptr(model.P, words[j]), &sum[0], D);
+        n += sign > 0.0 ? 1 : -1;
+    };
+    if (begin < end) {
+        for (long j = std::max(0L, begin - historyN);  j < begin;  ++j)
+            add(j, 1.0);
+        for (long j = begin + 1;  j <= begin + futureN && j < T;  ++j)
+            add(j, 1.0);
+    }
+    double ret = 0.0;
+    for (long i = begin;  i < end;  ++i) {
+        if (n > 0) {
+            for (int d = 0;  d < D;  ++d)
+                avg[d] = sum[d] / n;
+            ret += log_prob(model, &avg[0], words[i], &out[0]);
+        }
+        if (historyN > 0) {
+            if (i - historyN >= 0)
+                add(i - historyN, -1.0);
+            add(i, 1.0);
+        }
+        if (futureN > 0) {
+            if (i + 1 < T)
+                add(i + 1, -1.0);
+            if (i + 1 + futureN < T)
+                add(i + 1 + futureN, 1.0);
+        }
+    }
+    return ret;
+}
+
+// See `get_context`; `Words` is `std::vector<int>` or `Corpus`
+template<class Words>
+void get_context_impl(const Words& words, long index, int historyN, int futureN, std::vector<int>& out)
+{
+    const long T = words.size();
+    out.clear();
+    for (long j = std::max(0L, index - historyN);  j < index;  ++j)
+        out.push_back(words[j]);
+    for (long j = index + 1;  j <= index + futureN && j < T;  ++j)
+        out.push_back(words[j]);
+}
+
+template<class T>
+bool is_skipgram(const BasicCBOWModel<T>& model)
+{
+    return false;
+}
+
+template<class T>
+bool is_skipgram(const BasicSkipGramModel<T>& model)
+{
+    return true;
+}
+
+// Call f(inputs, word) for each training example predicting `word` from its
+// context `context`: for CBOW, a single example whose inputs are the whole
+// context; for skip-gram, one example per context word, whose only input is
+// that word.  There is no example for an empty context.  `single` is
+// scratch space.
+template<class Model, class F>
+void for_each_example(const Model& model, const std::vector<int>& context, int word, std::vector<int>& single, F f)
+{
+    if (!is_skipgram(model)) {
+        if (!context.empty())
+            f(context, word);
+        return;
+    }
+    single.resize(1);
+    for (int c : context) {
+        single[0] = c;
+        f(single, word);
+    }
+}
+
+// With subsampling, the corpus is processed in chunks of this many words,
+// from which the discarded words are removed before building the contexts
+// (like the sentences of the word2vec implementation)
+const int subsampling_chunk = 1000;
+
+// Run one epoch of online SGD over positions [begin, end) of `corpus`.
+// If `keep` is not empty, each word `w` is only kept with probability
+// keep[w] (see `keep_probabilities`).  The number of SGD steps is stored
+// in `examples`.
+template<class Model>
+void sgd_shard(Model& model, const Corpus& corpus, long begin, long end,
+               const AliasSampler& noise, int negative, const std::vector<double>& keep,
+               double lr, std::mt19937& rng, long& examples)
+{
+    examples = 0;
+    BasicSGDWorkspace<typename Model::value_type> ws(model.D);
+    std::vector<int> context;
+    std::vector<int> single;
+    std::vector<int> negatives(negative);
+    auto step = [&](const auto& words, long i) {
+        get_context_impl(words, i, model.historyN, model.futureN, context);
+        for_each_example(model, context, words[i], single, [&](const std::vector<int>& inputs, int word) {
+            for (int& n : negatives)
+                n = noise(rng);
+            model.sgd_step(inputs, word, negatives, lr, ws);
+            ++examples;
+        });
+    };
+    if (keep.empty()) {
+        for (long i = begin;  i < end;  ++i)
+            step(corpus, i);
+        return;
+    }
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<int> chunk;
+    for (long c = begin;  c < end;  c += subsampling_chunk) {
+        chunk.clear();
+        for (long i = c;  i < std::min(end, c + subsampling_chunk);  ++i) {
+            const int w = corpus[i];
+            if (keep[w] >= 1.0 || uniform(rng) < keep[w])
+                chunk.push_back(w);
+        }
+        for (long i = 0;  i < chunk.size();  ++i)
+            step(chunk, i);
+    }
+}
+
+// Sum of log(p(words[i] | c)) for each context word `c` of each position
+// `i` in [begin, end), as in the skip-gram model
+template<class Scalar, class Words>
+double sum_pair_log_prob(const BasicCBOWModel<Scalar>& model, const Words& words, long begin, long end)
+{
+    std::vector<double> out(model.W);
+    std::vector<int> context;
+    double ret = 0.0;
+    for (long i = begin;  i < end;  ++i) {
+        get_context_impl(words, i, model.historyN, model.futureN, context);
+        for (int c : context)
+            ret += log_prob(model, row_ptr(model.P, c), words[i], &out[0]);
+    }
+    return ret;
+}
+
+// See `CBOWModel::avg_log_prob` and `SkipGramModel::avg_log_prob`
+template<class Model, class Words>
+double parallel_avg_log_prob(const Model& model, const Words& words, int threads)
+{
+    std::vector<double> sums(threads, 0.0);
+    std::vector<std::thread> workers;
+    for (int t = 0;  t < threads;  ++t) {
+        const long begin = words.size() * t / threads;
+        const long end = words.size() * (t + 1) / threads;
+        workers.emplace_back([&model, &words, &sums, t, begin, end] {
+            sums[t] = is_skipgram(model)
+                    ? sum_pair_log_prob(model, words, begin, end)
+                    : sum_log_prob(model, words, begin, end);
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    double sum = 0.0;
+    for (double s : sums)
+        sum += s;
+    return sum / words.size();
+}
+
+// The log probability of position `i` of `words`, i.e. its term in the
+// sum of `avg_log_prob`
+template<class Model, class Words>
+double position_log_prob(const Model& model, const Words& words, long i)
+{
+    return is_skipgram(model)
+         ? sum_pair_log_prob(model, words, i, i + 1)
+         : sum_log_prob(model, words, i, i + 1);
+}
+
+// See `CBOWModel::gradients` and `SkipGramModel::gradients`
+template<class Model, class Words>
+BasicCBOWModelGradients<typename Model::value_type> corpus_gradients(const Model& model, const Words& words)
+{
+    typedef typename Model::value_type T;
+    const int W = model.W;
+    const int D = model.D;
+    const HuffmanTree& tree = model.tree;
+    const BasicEmbeddingMatrix<T>& P = model.P;
+    const BasicEmbeddingMatrix<T>& O = model.O;
+    const bool hierarchical = model.hierarchical();
+    BasicCBOWModelGradients<T> ret(W, D);
+    ublas::vector<T> avg(D);
+    ublas::vector<T> grad_avg(D);  // d(loss, avg)
+    ublas::vector<double> out(hierarchical ? 0 : W);
+    std::vector<int> context;
+    std::vector<int> single;
+    auto example = [&](const std::vector<int>& inputs, int word) {
+        context_average(P, inputs, avg);
+        std::fill(grad_avg.begin(), grad_avg.end(), T(0));
+        if (hierarchical) {
+            // loss = -sum_j(log(sigmoid(+/-x_j))), x_j = avg . O[points[j]]
+            for (int j = tree.offsets[word];  j < tree.offsets[word+1];  ++j) {
+                const int n = tree.points[j];
+                const double x = dot(&avg[0], row_ptr(O, n), D);
+                const double g = sigmoid(x) - (1 - tree.codes[j]);  // d(loss, x_j)
+                axpy(g, row_ptr(O, n), &grad_avg[0], D);
+                axpy(g, &avg[0], ret.O.row(n), D);
+            }
+        } else {
+            // loss = -log(softmax(out)[word]), see loss.md
+            for (int k = 0;  k < W;  ++k)
+                out[k] = dot(&avg[0], row_ptr(O, k), D);
+            softmax_into(out, out);
+            out[word] -= 1.0;  // d(loss, out)
+            for (int k = 0;  k < W;  ++k) {
+                axpy(out[k], row_ptr(O, k), &grad_avg[0], D);
+                axpy(out[k], &avg[0], ret.O.row(k), D);
+            }
+        }
+        for (int wordidx : inputs)
+            axpy(1.0 / inputs.size(), &grad_avg[0], ret.P.row(wordidx), D);
+        ++ret.examples;
+    };
+    for (long i = 0;  i < words.size();  ++i) {
+        get_context_impl(words, i, model.historyN, model.futureN, context);
+        for_each_example(model, context, words[i], single, example);
+    }
+    ret.P /= T(words.size());
+    ret.O /= T(words.size());
+    return ret;
+}
+
+} // namespace
+
 std::vector<int> get_context(const std::vector<int>& words, int index, int historyN, int futureN)
 {
     std::vector<int> ret;
-    for (int j = std::max(0, index - historyN);  j < index;  ++j)
-        ret.push_back(words[j]);
-    for (int j = 1;  j <= futureN && index+j < words.size();  ++j)
-        ret.push_back(words[index+j]);
+    get_context(words, index, historyN, futureN, ret);
+    return ret;
+}
+
+void get_context(const std::vector<int>& words, int index, int historyN, int futureN, std::vector<int>& out)
+{
+    get_context_impl(words, index, historyN, futureN, out);
+}
+
+void get_context(const Corpus& words, long index, int historyN, int futureN, std::vector<int>& out)
+{
+    get_context_impl(words, index, historyN, futureN, out);
+}
+
+HuffmanTree::HuffmanTree(const std::vector<long>& counts)
+{
+    const int W = counts.size();
+    // Nodes 0 ... W-1 are the leaves, nodes W ... 2W-2 are the inner nodes,
+    // created in increasing order of frequency; the last one is the root.
+    std::vector<int> parent(2 * W - 1, -1);
+    std::vector<char> code(2 * W - 1, 0);
+    typedef std::pair<long, int> Node;  // (count, node)
+    std::priority_queue<Node, std::vector<Node>, std::greater<>> queue;
+    for (int w = 0;  w < W;  ++w)
+        queue.push(std::make_pair(counts[w], w));
+    for (int n = W;  n < 2 * W - 1;  ++n) {
+        const Node left = queue.top();
+        queue.pop();
+        const Node right = queue.top();
+        queue.pop();
+        parent[left.second] = n;
+        parent[right.second] = n;
+        code[right.second] = 1;
+        queue.push(std::make_pair(left.first + right.first, n));
+    }
+    offsets.resize(W + 1);
+    offsets[0] = 0;
+    for (int w = 0;  w < W;  ++w) {
+        int depth = 0;
+        for (int n = w;  parent[n] != -1;  n = parent[n])
+            ++depth;
+        offsets[w+1] = offsets[w] + depth;
+    }
+    points.resize(offsets[W]);
+    codes.resize(offsets[W]);
+    for (int w = 0;  w < W;  ++w) {
+        // Walk up from the leaf and fill the path from its end
+        int j = offsets[w+1];
+        for (int n = w;  parent[n] != -1;  n = parent[n]) {
+            --j;
+            points[j] = parent[n] - W;
+            codes[j] = code[n];
+        }
+    }
+}
+
+std::vector<long> word_counts(const std::vector<int>& words, int W)
+{
+    std::vector<long> ret(W, 0);
+    for (int w : words)
+        ++ret[w];
+    return ret;
+}
+
+template<class T>
+void gradient_descent(ublas::matrix<T>& out, const ublas::matrix<T>& gradients, double lr)
+{
+    out -= gradients * T(lr);
+}
+
+template<class T>
+void gradient_descent(BasicEmbeddingMatrix<T>& out, const ublas::matrix<T>& gradients, double lr)
+{
+    out -= gradients * T(lr);
+}
+
+template void gradient_descent(ublas::matrix<float>&, const ublas::matrix<float>&, double);
+template void gradient_descent(ublas::matrix<double>&, const ublas::matrix<double>&, double);
+template void gradient_descent(BasicEmbeddingMatrix<float>&, const ublas::matrix<float>&, double);
+template void gradient_descent(BasicEmbeddingMatrix<double>&, const ublas::matrix<double>&, double);
+
+template<class T>
+BasicSparseRows<T>::BasicSparseRows(int rows, int cols)
+    : rows(rows)
+    , cols(cols)
+{
+}
+
+template<class T>
+T* BasicSparseRows<T>::row(int i)
+{
+    const auto inserted = positions.emplace(i, ids.size());
+    if (inserted.second) {
+        ids.push_back(i);
+        values.resize(values.size() + cols, T(0));
+    }
+    return &values[std::size_t(inserted.first->second) * cols];
+}
+
+template<class T>
+T BasicSparseRows<T>::operator()(int i, int j) const
+{
+    const auto it = positions.find(i);
+    return it == positions.end() ? T(0) : values[std::size_t(it->second) * cols + j];
+}
+
+template<class T>
+BasicSparseRows<T>& BasicSparseRows<T>::operator/=(T x)
+{
+    for (T& v : values)
+        v /= x;
+    return *this;
+}
+
+template<class T>
+ublas::matrix<T> BasicSparseRows<T>::dense() const
+{
+    ublas::matrix<T> ret = ublas::zero_matrix<T>(rows, cols);
+    for (int k = 0;  k < ids.size();  ++k)
+        std::copy_n(&values[std::size_t(k) * cols], cols, row_ptr(ret, ids[k]));
     return ret;
 }
 
-void gradient_descent(ublas::matrix<double>& out, const ublas::matrix<double>& gradients, double lr)
+template struct BasicSparseRows<float>;
+template struct BasicSparseRows<double>;
+
+namespace {
+
+template<class Matrix, class T>
+void sparse_gradient_descent(Matrix& out, const BasicSparseRows<T>& gradients, double lr)
+{
+    const int D = gradients.cols;
+    for (int k = 0;  k < gradients.ids.size();  ++k)
+        axpy(-lr, &gradients.values[std::size_t(k) * D], row_ptr(out, gradients.ids[k]), D);
+}
+
+} // namespace
+
+template<class T>
+void gradient_descent(ublas::matrix<T>& out, const BasicSparseRows<T>& gradients, double lr)
+{
+    sparse_gradient_descent(out, gradients, lr);
+}
+
+template<class T>
+void gradient_descent(BasicEmbeddingMatrix<T>& out, const BasicSparseRows<T>& gradients, double lr)
+{
+    sparse_gradient_descent(out, gradients, lr);
+}
+
+template void gradient_descent(ublas::matrix<float>&, const BasicSparseRows<float>&, double);
+template void gradient_descent(ublas::matrix<double>&, const BasicSparseRows<double>&, double);
+template void gradient_descent(BasicEmbeddingMatrix<float>&, const BasicSparseRows<float>&, double);
+template void gradient_descent(BasicEmbeddingMatrix<double>&, const BasicSparseRows<double>&, double);
+
+template<class T>
+BasicCBOWModelGradients<T>::BasicCBOWModelGradients(int W, int D)
+    : P(W, D)
+    , O(W, D)
+    , examples(0)
 {
-    out -= gradients * lr;
 }
 
-CBOWModelGradients::CBOWModelGradients(int W, int D)
-    : P(ublas::zero_matrix<double>(W, D))
-    , O(ublas::zero_matrix<double>(W, D))
+template<class T>
+BasicSGDWorkspace<T>::BasicSGDWorkspace(int D)
+    : avg(D)
+    , grad_avg(D)
 {
 }
 
-CBOWModel::CBOWModel(int W, int D, int historyN, int futureN)
+template<class T>
+BasicCBOWModel<T>::BasicCBOWModel(int W, int D, int historyN, int futureN)
     : W(W)
     , D(D)
     , historyN(historyN)
@@ -37,19 +647,28 @@ CBOWModel::CBOWModel(int W, int D, int historyN, int futureN)
 {
 }
 
-void CBOWModel::save(std::ostream& os) const
+template<class T>
+void BasicCBOWModel<T>::set_hierarchical(const HuffmanTree& tree)
+{
+    this->tree = tree;
+}
+
+template<class T>
+void BasicCBOWModel<T>::save(std::ostream& os) const
 {
     boost::archive::text_oarchive oa(os);
     oa << *this;
 }
 
-void CBOWModel::load(std::istream& is)
+template<class T>
+void BasicCBOWModel<T>::load(std::istream& is)
 {
     boost::archive::text_iarchive ia(is);
     ia >> *this;
 }
 
-std::vector<std::pair<double, int>> CBOWModel::predict(const std::vector<int>& context) const
+template<class T>
+std::vector<std::pair<double, int>> BasicCBOWModel<T>::predict(const std::vector<int>& context) const
 {
     ublas::vector<double> smax = predict_helper(context);
     std::vector<std::pair<double, int>> ret(W);
@@ -59,57 +678,681 @@ std::vector<std::pair<double, int>> CBOWModel::predict(const std::vector<int>& c
     return ret;
 }
 
-double CBOWModel::predict(const std::vector<int>& context, int word) const
+template<class T>
+void BasicCBOWModel<T>::save_binary(std::ostream& os) const
 {
-    ublas::vector<double> smax = predict_helper(context);
-    return smax[word];
+    BinaryHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, binary_magic, sizeof(binary_magic));
+    h.version = binary_version;
+    h.scalar_size = sizeof(T);
+    h.W = W;
+    h.D = D;
+    h.historyN = historyN;
+    h.futureN = futureN;
+    h.tree_points = tree.points.size();
+    const BinaryLayout layout(h);
+    const std::vector<char> padding(binary_alignment, 0);
+    os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    os.write(reinterpret_cast<const char*>(&P.data()[0]), P.data().size() * sizeof(T));
+    os.write(padding.data(), layout.O - layout.P - P.data().size() * sizeof(T));
+    os.write(reinterpret_cast<const char*>(&O.data()[0]), O.data().size() * sizeof(T));
+    os.write(padding.data(), layout.tree - layout.O - O.data().size() * sizeof(T));
+    if (hierarchical()) {
+        os.write(reinterpret_cast<const char*>(tree.offsets.data()), tree.offsets.size() * 4);
+        os.write(reinterpret_cast<const char*>(tree.points.data()), tree.points.size() * 4);
+        os.write(tree.codes.data(), tree.codes.size());
+    }
 }
 
-ublas::vector<double> CBOWModel::predict_helper(const std::vector<int>& context) const
+template<class T>
+void BasicCBOWModel<T>::load_binary(std::istream& is)
 {
-    // average embedding of all context words
-    ublas::vector<double> avg(D, 0.0);
-    for (int wordidx : context)
-        avg += ublas::row(P, wordidx);
-    avg /= context.size();
-    // output layer (before softmax)
-    ublas::vector<double> out(W, 0.0);
-    for (int i = 0;  i < W;  ++i)
-        out[i] = dot_product(avg, row(O, i));
-    // softmax
-    ublas::vector<double> smax = softmax(out);
-    return smax;
+    BinaryHeader h;
+    if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)))
+        throw std::runtime_error("CBOWModel: truncated binary model");
+    check_header(h, sizeof(T));
+    const BinaryLayout layout(h);
+    // P and O are read in place; only the tree goes through a buffer.  The
+    // model is left unchanged if the stream is truncated.
+    Matrix newP(h.W, h.D);
+    Matrix newO(h.W, h.D);
+    std::vector<char> buffer(layout.end - layout.tree);
+    std::size_t pos = sizeof(h);
+    read_section(is, pos, layout.P, &newP.data()[0], newP.data().size() * sizeof(T));
+    read_section(is, pos, layout.O, &newO.data()[0], newO.data().size() * sizeof(T));
+    read_section(is, pos, layout.tree, buffer.data(), buffer.size());
+    W = h.W;
+    D = h.D;
+    historyN = h.historyN;
+    futureN = h.futureN;
+    P.swap(newP);
+    O.swap(newO);
+    read_tree(tree, h, buffer.data());
 }
 
-double CBOWModel::avg_log_prob(const std::vector<int>& words) const
+template<class T>
+void BasicCBOWModel<T>::load_mapped(const std::string& path)
 {
-    double sum = 0.0;
-    for (int i = 0;  i < words.size();  ++i) {
-        std::vector<int> context = get_context(words, i, historyN, futureN);
-        double p = predict(context, words[i]);
-        sum += std::log(p);
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+    BinaryHeader h;
+    if (file->size < sizeof(h))
+        throw std::runtime_error("CBOWModel: truncated binary model " + path);
+    std::memcpy(&h, file->data, sizeof(h));
+    check_header(h, sizeof(T));
+    const BinaryLayout layout(h);
+    if (file->size < layout.end)
+        throw std::runtime_error("CBOWModel: truncated binary model " + path);
+    W = h.W;
+    D = h.D;
+    historyN = h.historyN;
+    futureN = h.futureN;
+    // Swap the mapped memory into empty matrices of the right dimensions
+    T* data = reinterpret_cast<T*>(file->data + layout.P);
+    Matrix mappedP(W, D, MappableArray<T>());
+    MappableArray<T> arrayP(std::size_t(W) * D, data, file);
+    mappedP.data().swap(arrayP);
+    P.swap(mappedP);
+    data = reinterpret_cast<T*>(file->data + layout.O);
+    Matrix mappedO(W, D, MappableArray<T>());
+    MappableArray<T> arrayO(std::size_t(W) * D, data, file);
+    mappedO.data().swap(arrayO);
+    O.swap(mappedO);
+    read_tree(tree, h, file->data + layout.tree);
+}
+
+template<class T>
+std::vector<std::pair<double, int>> BasicCBOWModel<T>::predict_topk(const std::vector<int>& context, int k, bool normalize) const
+{
+    if (hierarchical())
+        return top_k(predict_helper(context), k);
+    ublas::vector<T> avg(D);
+    context_average(P, context, avg);
+    TopK top(std::min(k, W));
+    if (!normalize) {
+        // The logits go straight into the heap: no W-sized buffer
+        for (int i = 0;  i < W;  ++i)
+            top.push(dot(&avg[0], row_ptr(O, i), D), i);
+        return top.sorted();
     }
-    return sum / words.size();
+    // The normalizer needs every logit
+    std::vector<double> out(W);
+    for (int i = 0;  i < W;  ++i) {
+        out[i] = dot(&avg[0], row_ptr(O, i), D);
+        top.push(out[i], i);
+    }
+    // softmax(out)[i] = exp(out[i] - logsumexp(out))
+    const double lse = logsumexp(out.data(), W);
+    std::vector<std::pair<double, int>> ret = top.sorted();
+    for (auto& p : ret)
+        p.first = std::exp(p.first - lse);
+    return ret;
+}
+
+template<class T>
+double BasicCBOWModel<T>::predict(const std::vector<int>& context, int word) const
+{
+    if (!hierarchical()) {
+        ublas::vector<double> smax = predict_helper(context);
+        return smax[word];
+    }
+    ublas::vector<T> avg(D);
+    context_average(P, context, avg);
+    // product of the probabilities of each branch on the path to `word`
+    double p = 1.0;
+    for (int j = tree.offsets[word];  j < tree.offsets[word+1];  ++j) {
+        const double x = dot(&avg[0], row_ptr(O, tree.points[j]), D);
+        p *= sigmoid(tree.codes[j] ? -x : x);
+    }
+    return p;
+}
+
+template<class T>
+ublas::vector<double> BasicCBOWModel<T>::predict_helper(const std::vector<int>& context) const
+{
+    // average embedding of all context words
+    ublas::vector<T> avg(D);
+    context_average(P, context, avg);
+    // logits of each inner node, or output layer (before softmax): O * avg
+    ublas::vector<double> out(W);
+    output_logits(O, &avg[0], hierarchical() ? W - 1 : W, &out[0]);
+    if (hierarchical()) {
+        ublas::vector<double> ret(W);
+        tree_probabilities(tree, &out[0], &ret[0]);
+        return ret;
+    }
+    softmax_into(out, out);
+    return out;
 }
 
-CBOWModelGradients CBOWModel::gradients() const
+template<class T>
+ublas::matrix<T> BasicCBOWModel<T>::predict_batch(const std::vector<std::vector<int>>& contexts) const
 {
-    CBOWModelGradients ret(W, D);
-    // TODO!
+    // average embeddings of each context, stacked
+    const int B = contexts.size();
+    ublas::matrix<T> avg(B, D);
+    ublas::vector<T> h(D);
+    for (int b = 0;  b < B;  ++b) {
+        context_average(P, contexts[b], h);
+        ublas::row(avg, b) = h;
+    }
+    // output layer (before softmax) for all contexts at once, using O in place
+    ublas::matrix<T> out(B, W);
+    if (B > 0)
+        prod_trans(&avg.data()[0], &O.data()[0], &out.data()[0], B, W, D);
+    if (!hierarchical()) {
+        softmax_rows(out);
+        return out;
+    }
+    ublas::matrix<T> ret(B, W);
+    for (int b = 0;  b < B;  ++b)
+        tree_probabilities(tree, row_ptr(out, b), row_ptr(ret, b));
     return ret;
 }
 
-void CBOWModel::update(const CBOWModelGradients& gradients, double lr)
+template<class T>
+double BasicCBOWModel<T>::avg_log_prob(const std::vector<int>& words, int threads) const
+{
+    return parallel_avg_log_prob(*this, words, threads);
+}
+
+template<class T>
+double BasicCBOWModel<T>::avg_log_prob(const Corpus& words, int threads) const
+{
+    return parallel_avg_log_prob(*this, words, threads);
+}
+
+template<class T>
+BasicCBOWModelGradients<T> BasicCBOWModel<T>::gradients(const std::vector<int>& words) const
+{
+    return corpus_gradients(*this, words);
+}
+
+template<class T>
+BasicCBOWModelGradients<T> BasicCBOWModel<T>::gradients(const Corpus& words) const
+{
+    return corpus_gradients(*this, words);
+}
+
+template<class T>
+void BasicCBOWModel<T>::update(const BasicCBOWModelGradients<T>& gradients, double lr)
 {
     gradient_descent(P, gradients.P, lr);
     gradient_descent(O, gradients.O, lr);
 }
 
+template<class T>
+void BasicCBOWModel<T>::sgd_step(const std::vector<int>& context, int word, const std::vector<int>& negatives, double lr, BasicSGDWorkspace<T>& ws)
+{
+    context_average(P, context, ws.avg);
+    std::fill(ws.grad_avg.begin(), ws.grad_avg.end(), T(0));
+    const T* avg = &ws.avg[0];
+    T* grad_avg = &ws.grad_avg[0];
+    // For each output vector: accumulate d(loss, avg) first, since it
+    // depends on the output vector before its update
+    if (hierarchical()) {
+        for (int j = tree.offsets[word];  j < tree.offsets[word+1];  ++j) {
+            T* o = row_ptr(O, tree.points[j]);
+            const double g = sigmoid(dot(avg, o, D)) - (1 - tree.codes[j]);
+            axpy(g, o, grad_avg, D);
+            axpy(-lr * g, avg, o, D);
+        }
+    }
+    if (!negatives.empty()) {
+        // loss = -log(sigmoid(avg . O[word])) - sum_n(log(sigmoid(-avg . O[n])))
+        T* o = row_ptr(O, word);
+        double g = sigmoid(dot(avg, o, D)) - 1.0;
+        axpy(g, o, grad_avg, D);
+        axpy(-lr * g, avg, o, D);
+        for (int n : negatives) {
+            if (n == word)
+                continue;
+            o = row_ptr(O, n);
+            g = sigmoid(dot(avg, o, D));
+            axpy(g, o, grad_avg, D);
+            axpy(-lr * g, avg, o, D);
+        }
+    }
+    if (!hierarchical() && negatives.empty()) {
+        ws.out.resize(W, false);
+        for (int k = 0;  k < W;  ++k)
+            ws.out[k] = dot(avg, row_ptr(O, k), D);
+        softmax_into(ws.out, ws.out);
+        ws.out[word] -= 1.0;
+        for (int k = 0;  k < W;  ++k) {
+            T* o = row_ptr(O, k);
+            axpy(ws.out[k], o, grad_avg, D);
+            axpy(-lr * ws.out[k], avg, o, D);
+        }
+    }
+    for (int wordidx : context)
+        axpy(-lr / context.size(), grad_avg, row_ptr(P, wordidx), D);
+}
+
+template struct BasicCBOWModelGradients<float>;
+template struct BasicCBOWModelGradients<double>;
+template struct BasicSGDWorkspace<float>;
+template struct BasicSGDWorkspace<double>;
+template struct BasicCBOWModel<float>;
+template struct BasicCBOWModel<double>;
+
+template<class T>
+BasicSkipGramModel<T>::BasicSkipGramModel(int W, int D, int historyN, int futureN)
+    : BasicCBOWModel<T>(W, D, historyN, futureN)
+{
+}
+
+template<class T>
+std::vector<std::pair<double, int>> BasicSkipGramModel<T>::predict(int word) const
+{
+    return this->predict(std::vector<int>{word});
+}
+
+template<class T>
+std::vector<std::pair<double, int>> BasicSkipGramModel<T>::predict_topk(int word, int k, bool normalize) const
+{
+    return this->predict_topk(std::vector<int>{word}, k, normalize);
+}
+
+template<class T>
+ublas::matrix<T> BasicSkipGramModel<T>::predict_batch(const std::vector<int>& words) const
+{
+    std::vector<std::vector<int>> contexts(words.size());
+    for (int b = 0;  b < words.size();  ++b)
+        contexts[b].assign(1, words[b]);
+    return this->predict_batch(contexts);
+}
+
+template<class T>
+double BasicSkipGramModel<T>::avg_log_prob(const std::vector<int>& words, int threads) const
+{
+    return parallel_avg_log_prob(*this, words, threads);
+}
+
+template<class T>
+double BasicSkipGramModel<T>::avg_log_prob(const Corpus& words, int threads) const
+{
+    return parallel_avg_log_prob(*this, words, threads);
+}
+
+template<class T>
+BasicCBOWModelGradients<T> BasicSkipGramModel<T>::gradients(const std::vector<int>& words) const
+{
+    return corpus_gradients(*this, words);
+}
+
+template<class T>
+BasicCBOWModelGradients<T> BasicSkipGramModel<T>::gradients(const Corpus& words) const
+{
+    return corpus_gradients(*this, words);
+}
+
+template struct BasicSkipGramModel<float>;
+template struct BasicSkipGramModel<double>;
+
+template<class Model>
+LogProbEstimate estimate_avg_log_prob(const Model& model, const Corpus& words, long samples, unsigned int seed)
+{
+    const long T = words.size();
+    if (samples >= T) {
+        double sum = 0.0;
+        for (long i = 0;  i < T;  ++i)
+            sum += position_log_prob(model, words, i);
+        return {sum / T, 0.0, T};
+    }
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<long> dist(0, T - 1);
+    // Welford's algorithm for the mean and variance
+    double mean = 0.0;
+    double m2 = 0.0;
+    for (long s = 1;  s <= samples;  ++s) {
+        const double x = position_log_prob(model, words, dist(rng));
+        const double delta = x - mean;
+        mean += delta / s;
+        m2 += delta * (x - mean);
+    }
+    const double variance = samples > 1 ? m2 / (samples - 1) : 0.0;
+    return {mean, 1.96 * std::sqrt(variance / samples), samples};
+}
+
+template LogProbEstimate estimate_avg_log_prob(const CBOWModel&, const Corpus&, long, unsigned int);
+template LogProbEstimate estimate_avg_log_prob(const FloatCBOWModel&, const Corpus&, long, unsigned int);
+template LogProbEstimate estimate_avg_log_prob(const SkipGramModel&, const Corpus&, long, unsigned int);
+template LogProbEstimate estimate_avg_log_prob(const FloatSkipGramModel&, const Corpus&, long, unsigned int);
+
+namespace {
+
+// See `save_checkpoint`
+struct CheckpointHeader {
+    char magic[8];
+    std::int32_t version;
+    std::int32_t epoch;
+    double best_avg_log_prob;
+    std::int32_t stale_epochs;
+    char reserved[4];
+};
+
+static_assert(sizeof(CheckpointHeader) == 32, "CheckpointHeader must be 32 bytes");
+
+const char checkpoint_magic[8] = {'T', 'O', 'Y', 'N', 'E', 'T', 'K', '1'};
+const std::int32_t checkpoint_version = 1;
+
+// Writes checkpoints on a background thread from a copy of the model, so
+// that training can go on while a checkpoint is written
+template<class Model>
+struct BackgroundCheckpointer {
+    BackgroundCheckpointer(const std::string& path, const Model& model)
+        : path(path)
+        , snapshot(model)
+    {
+    }
+
+    ~BackgroundCheckpointer()
+    {
+        if (writer.joinable())
+            writer.join();
+    }
+
+    // Copy `model` and start writing it with `state`
+    void write(const Model& model, const CheckpointState& state)
+    {
+        wait();
+        snapshot = model;
+        this->state = state;
+        writer = std::thread([this] {
+            try {
+                save_checkpoint(this->path, snapshot, this->state);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        });
+    }
+
+    // Wait until the current checkpoint is written, and rethrow the error
+    // that occurred while writing it, if any
+    void wait()
+    {
+        if (writer.joinable())
+            writer.join();
+        if (error) {
+            const std::exception_ptr e = error;
+            error = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+    std::string path;
+    Model snapshot;
+    CheckpointState state;
+    std::thread writer;
+    std::exception_ptr error;
+};
+
+// Data-parallel online SGD over worker processes, see `Trainer::setProcesses`.
+// Each epoch is split into rounds; in each round, each worker copies the
+// average model from shared memory, runs SGD over the next `syncInterval`
+// positions of its shard, and copies its replica back to shared memory.
+// The coordinator (the process that constructed the pool) then averages the
+// replicas of the workers that finished the round.  The processes only
+// communicate through the atomic counters of the shared segment, which they
+// poll, so that the coordinator never blocks on a dead worker.
+template<class Model>
+struct ProcessPool {
+    typedef typename Model::value_type T;
+
+    // The control block at the beginning of the shared segment
+    struct Control {
+        // The last round started by the coordinator, or -1 to stop
+        std::atomic<long> round;
+        // The learning rate of the current round
+        std::atomic<double> lr;
+    };
+
+    // The state of one worker, on its own cache line
+    struct alignas(64) Slot {
+        // The last round finished by the worker
+        std::atomic<long> finished;
+        // The number of SGD steps of that round
+        std::atomic<long> examples;
+    };
+
+    static_assert(std::atomic<long>::is_always_lock_free, "atomics must be lock-free to be shared between processes");
+    static_assert(std::atomic<double>::is_always_lock_free, "atomics must be lock-free to be shared between processes");
+
+    // Start `processes` workers training replicas of `model` on `corpus`.
+    // No other thread may be running, since the workers are forked.
+    ProcessPool(const Model& model, const Corpus& corpus, int processes, long syncInterval,
+                const AliasSampler& noise, int negative, const std::vector<double>& keep, unsigned int seed)
+        : processes(processes)
+        , syncInterval(syncInterval)
+        , matrix_size(std::size_t(model.W) * model.D)
+        , shm(align_up(sizeof(Control)) + processes * sizeof(Slot) + (processes + 1) * 2 * matrix_size * sizeof(T))
+        , pids(processes, -1)
+        , round(0)
+    {
+        control = new (shm.data) Control();
+        control->round = 0;
+        slots = reinterpret_cast<Slot*>(shm.data + align_up(sizeof(Control)));
+        for (int w = 0;  w < processes;  ++w)
+            new (&slots[w]) Slot();
+        models = reinterpret_cast<T*>(shm.data + align_up(sizeof(Control)) + processes * sizeof(Slot));
+        publish(model, average());
+        // Number of rounds per epoch, so that the longest shard is covered
+        const long longest = (corpus.size() + processes - 1) / processes;
+        rounds = std::max(1L, (longest + syncInterval - 1) / syncInterval);
+        for (int w = 0;  w < processes;  ++w) {
+            const pid_t pid = fork();
+            if (pid < 0) {
+                stop();
+                throw std::runtime_error(std::string("Trainer: cannot fork: ") + std::strerror(errno));
+            }
+            if (pid == 0) {
+                // Never return to the caller's stack in the child
+                try {
+                    work(w, model, corpus, noise, negative, keep, seed);
+                } catch (...) {
+                    _exit(1);
+                }
+                _exit(0);
+            }
+            pids[w] = pid;
+        }
+    }
+
+    ~ProcessPool()
+    {
+        stop();
+    }
+
+    // The average model, followed by the replica of each worker, each of
+    // them being P followed by O
+    T* average() { return models; }
+    T* replica(int w) { return models + (w + 1) * 2 * matrix_size; }
+
+    // Copy the parameters of `model` to `out`
+    void publish(const Model& model, T* out)
+    {
+        std::copy_n(&model.P.data()[0], matrix_size, out);
+        std::copy_n(&model.O.data()[0], matrix_size, out + matrix_size);
+    }
+
+    // Copy `in` to the parameters of `model`
+    void receive(const T* in, Model& model)
+    {
+        std::copy_n(in, matrix_size, &model.P.data()[0]);
+        std::copy_n(in + matrix_size, matrix_size, &model.O.data()[0]);
+    }
+
+    // The main loop of worker `w`
+    void work(int w, const Model& initial, const Corpus& corpus,
+              const AliasSampler& noise, int negative, const std::vector<double>& keep, unsigned int seed)
+    {
+        Model model(initial);
+        std::mt19937 rng(seed + 1 + w);
+        const long begin = corpus.size() * w / processes;
+        const long end = corpus.size() * (w + 1) / processes;
+        for (long r = 1;  ;  ++r) {
+            long go;
+            while ((go = control->round.load()) >= 0 && go < r)
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            if (go < 0)
+                return;
+            const long k = (r - 1) % rounds;
+            receive(average(), model);
+            long examples = 0;
+            sgd_shard(model, corpus, std::min(end, begin + k * syncInterval), std::min(end, begin + (k + 1) * syncInterval),
+                      noise, negative, keep, control->lr.load(), rng, examples);
+            publish(model, replica(w));
+            slots[w].examples = examples;
+            slots[w].finished = r;
+        }
+    }
+
+    // Whether worker `w` is still running; reaps it if it died
+    bool alive(int w)
+    {
+        if (pids[w] < 0)
+            return false;
+        int status;
+        if (waitpid(pids[w], &status, WNOHANG) == pids[w])
+            pids[w] = -1;
+        return pids[w] >= 0;
+    }
+
+    // Run one epoch with learning rate `lr`, and store the average of the
+    // replicas in `model`.
+    // Return value: the number of SGD steps of the epoch
+    long epoch(Model& model, double lr)
+    {
+        long examples = 0;
+        for (long k = 0;  k < rounds;  ++k) {
+            control->lr = lr;
+            control->round = ++round;
+            std::vector<int> done;
+            for (int w = 0;  w < processes;  ++w) {
+                while (slots[w].finished.load() < round && alive(w))
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                if (slots[w].finished.load() >= round) {
+                    done.push_back(w);
+                    examples += slots[w].examples.load();
+                }
+            }
+            if (done.empty())
+                throw std::runtime_error("Trainer: all the worker processes died");
+            T* avg = average();
+            for (std::size_t i = 0;  i < 2 * matrix_size;  ++i) {
+                double sum = 0.0;
+                for (int w : done)
+                    sum += replica(w)[i];
+                avg[i] = sum / done.size();
+            }
+        }
+        receive(average(), model);
+        return examples;
+    }
+
+    // Stop the workers and wait for them
+    void stop()
+    {
+        control->round = -1;
+        for (int w = 0;  w < processes;  ++w) {
+            if (pids[w] >= 0) {
+                int status;
+                waitpid(pids[w], &status, 0);
+                pids[w] = -1;
+            }
+        }
+    }
+
+    static std::size_t align_up(std::size_t n) { return (n + 63) / 64 * 64; }
+
+    int processes;
+    long syncInterval;
+    std::size_t matrix_size;
+    SharedMemory shm;
+    Control* control;
+    Slot* slots;
+    T* models;
+    std::vector<pid_t> pids;
+    long round;
+    long rounds;
+};
+
+// The peak resident set size of the process, in kilobytes
+long peak_rss_kb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;  // kilobytes on Linux
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+} // namespace
+
+template<class Model>
+void save_checkpoint(const std::string& path, const Model& model, const CheckpointState& state)
+{
+    const std::string tmp = path + ".tmp";
+    std::ofstream os(tmp, std::ios::binary | std::ios::trunc);
+    if (!os)
+        throw std::runtime_error("save_checkpoint: cannot create " + tmp);
+    CheckpointHeader h = {};
+    std::memcpy(h.magic, checkpoint_magic, sizeof(checkpoint_magic));
+    h.version = checkpoint_version;
+    h.epoch = state.epoch;
+    h.best_avg_log_prob = state.best_avg_log_prob;
+    h.stale_epochs = state.stale_epochs;
+    os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    model.save_binary(os);
+    os.close();
+    if (!os)
+        throw std::runtime_error("save_checkpoint: cannot write " + tmp);
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("save_checkpoint: cannot rename " + tmp + " to " + path);
+}
+
+template<class Model>
+CheckpointState load_checkpoint(const std::string& path, Model& model)
+{
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+        throw std::runtime_error("load_checkpoint: cannot open " + path);
+    CheckpointHeader h;
+    if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)))
+        throw std::runtime_error("load_checkpoint: truncated checkpoint " + path);
+    if (std::memcmp(h.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0)
+        throw std::runtime_error("load_checkpoint: not a checkpoint " + path);
+    if (h.version != checkpoint_version)
+        throw std::runtime_error("load_checkpoint: unsupported checkpoint version " + std::to_string(h.version));
+    model.load_binary(is);
+    return {h.epoch, h.best_avg_log_prob, h.stale_epochs};
+}
+
+template void save_checkpoint(const std::string&, const CBOWModel&, const CheckpointState&);
+template void save_checkpoint(const std::string&, const FloatCBOWModel&, const CheckpointState&);
+template void save_checkpoint(const std::string&, const SkipGramModel&, const CheckpointState&);
+template void save_checkpoint(const std::string&, const FloatSkipGramModel&, const CheckpointState&);
+template CheckpointState load_checkpoint(const std::string&, CBOWModel&);
+template CheckpointState load_checkpoint(const std::string&, FloatCBOWModel&);
+template CheckpointState load_checkpoint(const std::string&, SkipGramModel&);
+template CheckpointState load_checkpoint(const std::string&, FloatSkipGramModel&);
+
 SimpleReporter::SimpleReporter(std::ostream& os)
     : os(os)
 {
 }
 
+JsonLinesReporter::JsonLinesReporter(std::ostream& os)
+    : os(os)
+{
+}
+
 SimpleLearningRate::SimpleLearningRate(double lr, int cutoff, double base)
     : lr(lr)
     , cutoff(cutoff)
@@ -120,9 +1363,39 @@ SimpleLearningRate::SimpleLearningRate(double lr, int cutoff, double base)
 void SimpleReporter::operator()(const ReportData& data) const
 {
     os << "epoch " << data.epoch
-       << " prob " << data.avg_log_prob
-       << " lr " << data.lr
-       << "\n";
+       << " prob " << data.avg_log_prob;
+    if (data.avg_log_prob_error > 0.0)
+        os << " +/- " << data.avg_log_prob_error;
+    os << " lr " << data.lr;
+    if (data.words_per_sec > 0.0)
+        os << " words/sec/thread " << data.words_per_sec;
+    os << "\n";
+}
+
+void JsonLinesReporter::operator()(const ReportData& data) const
+{
+    // Format the line separately so that the stream's flags are left as is
+    std::ostringstream line;
+    line.precision(std::numeric_limits<double>::max_digits10);
+    auto number = [&line](const char* name, double x) {
+        line << ",\"" << name << "\":";
+        if (std::isfinite(x))
+            line << x;
+        else
+            line << "null";
+    };
+    line << "{\"epoch\":" << data.epoch;
+    number("avg_log_prob", data.avg_log_prob);
+    number("avg_log_prob_error", data.avg_log_prob_error);
+    number("lr", data.lr);
+    number("words_per_sec", data.words_per_sec);
+    number("examples_per_sec", data.examples_per_sec);
+    number("gradients_seconds", data.gradients_seconds);
+    number("update_seconds", data.update_seconds);
+    number("evaluation_seconds", data.evaluation_seconds);
+    number("checkpoint_seconds", data.checkpoint_seconds);
+    line << ",\"peak_rss_kb\":" << data.peak_rss_kb << "}\n";
+    os << line.str();
 }
 
 double SimpleLearningRate::operator()(int epoch) const
@@ -137,6 +1410,20 @@ Trainer::Trainer()
     , D(50)
     , historyN(4)
     , futureN(4)
+    , hierarchical(false)
+    , negative(0)
+    , online(false)
+    , threads(1)
+    , sample(0.0)
+    , processes(1)
+    , syncInterval(100000)
+    , seed(0)
+    , validationSamples(0)
+    , patience(0)
+    , minDelta(0.0)
+    , checkpointEpochs(1)
+    , checkpointSeconds(0.0)
+    , resume(false)
     , initReporter(nullptr)
     , epochReporter(nullptr)
     , exitReporter(nullptr)
@@ -192,29 +1479,264 @@ Trainer& Trainer::setLearningRate(const LearningRate *learningRate)
     return *this;
 }
 
-CBOWModel Trainer::train(const std::vector<int>& corpus) const
+Trainer& Trainer::setHierarchicalSoftmax(bool hierarchical)
+{
+    this->hierarchical = hierarchical;
+    return *this;
+}
+
+Trainer& Trainer::setNegative(int negative)
+{
+    this->negative = negative;
+    return *this;
+}
+
+Trainer& Trainer::setOnline(bool online)
+{
+    this->online = online;
+    return *this;
+}
+
+Trainer& Trainer::setThreads(int threads)
+{
+    this->threads = threads;
+    return *this;
+}
+
+Trainer& Trainer::setSample(double sample)
+{
+    this->sample = sample;
+    return *this;
+}
+
+Trainer& Trainer::setProcesses(int processes, long syncInterval)
+{
+    this->processes = processes;
+    this->syncInterval = syncInterval;
+    return *this;
+}
+
+Trainer& Trainer::setSeed(unsigned int seed)
+{
+    this->seed = seed;
+    return *this;
+}
+
+Trainer& Trainer::setValidation(const Corpus& validation)
+{
+    this->validation = validation;
+    return *this;
+}
+
+Trainer& Trainer::setValidationSamples(long samples)
+{
+    this->validationSamples = samples;
+    return *this;
+}
+
+Trainer& Trainer::setEarlyStopping(int patience, double minDelta)
+{
+    this->patience = patience;
+    this->minDelta = minDelta;
+    return *this;
+}
+
+Trainer& Trainer::setCheckpoint(const std::string& path, int everyEpochs, double everySeconds)
 {
-    // Find W, the maximum number of words
-    int W = *std::max_element(corpus.begin(), corpus.end()) + 1;
-    CBOWModel model(W, D, historyN, futureN);
+    this->checkpointPath = path;
+    this->checkpointEpochs = everyEpochs;
+    this->checkpointSeconds = everySeconds;
+    return *this;
+}
+
+Trainer& Trainer::setResume(bool resume)
+{
+    this->resume = resume;
+    return *this;
+}
+
+template<class T>
+BasicCBOWModel<T> Trainer::train(const std::vector<int>& corpus) const
+{
+    return train_model<BasicCBOWModel<T>>(Corpus(corpus));
+}
+
+template<class T>
+BasicCBOWModel<T> Trainer::train(const Corpus& corpus) const
+{
+    return train_model<BasicCBOWModel<T>>(corpus);
+}
+
+template<class T>
+BasicSkipGramModel<T> Trainer::train_skipgram(const std::vector<int>& corpus) const
+{
+    return train_model<BasicSkipGramModel<T>>(Corpus(corpus));
+}
+
+template<class T>
+BasicSkipGramModel<T> Trainer::train_skipgram(const Corpus& corpus) const
+{
+    return train_model<BasicSkipGramModel<T>>(corpus);
+}
+
+template<class Model>
+Model Trainer::train_model(const Corpus& corpus) const
+{
+    typedef typename Model::value_type T;
+    const int W = corpus.W;
+    Model model(W, D, historyN, futureN);
+    const std::vector<long>& counts = corpus.counts;
+    if (validation.W > W)
+        throw std::runtime_error("Trainer: the validation corpus has words unknown to the training corpus");
+    if (!in_vocabulary(corpus) || !in_vocabulary(validation))
+        throw std::runtime_error("Trainer: word index out of range");
+    if (hierarchical && negative > 0)
+        throw std::runtime_error("Trainer: hierarchical softmax and negative sampling are exclusive");
+    if (hierarchical)
+        model.set_hierarchical(HuffmanTree(counts));
+    AliasSampler noise;
+    if (negative > 0)
+        noise = AliasSampler(unigram_distribution(counts));
+    std::vector<double> keep;
+    if (sample > 0.0)
+        keep = keep_probabilities(counts, sample);
+    // Small random embeddings, zero output vectors (as in word2vec)
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> dist(-0.5 / D, 0.5 / D);
+    for (T& x : model.P.data())
+        x = dist(rng);
+    model.O = ublas::zero_matrix<T>(W, D);
+    // One random number generator per SGD thread
+    std::vector<std::mt19937> rngs;
+    for (int t = 0;  t < threads;  ++t)
+        rngs.emplace_back(seed + 1 + t);
+    const Corpus& eval = validation.empty() ? corpus : validation;
+    auto evaluate = [&]() -> LogProbEstimate {
+        if (validationSamples > 0)
+            return estimate_avg_log_prob(model, eval, validationSamples, seed);
+        return {model.avg_log_prob(eval, threads), 0.0, long(eval.size())};
+    };
     int e = 0;
-    double avg_log_prob = model.avg_log_prob(corpus);
-    double lr = (*learningRate)(e);
+    double best = -std::numeric_limits<double>::infinity();
+    int stale = 0;  // number of epochs in a row without improvement
+    const bool resumed = resume && !checkpointPath.empty() && std::filesystem::exists(checkpointPath);
+    if (resumed) {
+        const HuffmanTree tree = model.tree;
+        const CheckpointState state = load_checkpoint(checkpointPath, model);
+        const bool same_tree = model.tree.offsets == tree.offsets && model.tree.points == tree.points
+            && model.tree.codes == tree.codes;
+        if (model.W != W || model.D != D || model.historyN != historyN || model.futureN != futureN || !same_tree)
+            throw std::runtime_error("Trainer: the checkpoint does not match the training corpus or settings");
+        e = state.epoch;
+        best = state.best_avg_log_prob;
+        stale = state.stale_epochs;
+    }
+    auto start = std::chrono::steady_clock::now();
+    LogProbEstimate estimate = evaluate();
+    ReportData data = {};
+    data.epoch = e;
+    data.avg_log_prob = estimate.avg_log_prob;
+    data.avg_log_prob_error = estimate.error;
+    data.lr = learningRate ? (*learningRate)(e) : 1.0;
+    data.evaluation_seconds = seconds_since(start);
+    data.peak_rss_kb = peak_rss_kb();
     if (initReporter)
-        (*initReporter)({e, avg_log_prob, lr});
+        (*initReporter)(data);
+    if (!resumed)
+        best = estimate.avg_log_prob;
+    // Forked before any other thread is started
+    std::unique_ptr<ProcessPool<Model>> pool;
+    if (processes > 1)
+        pool.reset(new ProcessPool<Model>(model, corpus, processes, syncInterval, noise, negative, keep, seed));
+    std::unique_ptr<BackgroundCheckpointer<Model>> checkpointer;
+    if (!checkpointPath.empty())
+        checkpointer.reset(new BackgroundCheckpointer<Model>(checkpointPath, model));
+    auto last_checkpoint = std::chrono::steady_clock::now();
     while (e <= epochs) {
         ++e;
-        CBOWModelGradients gradients = model.gradients();
-        lr = learningRate ? (*learningRate)(e) : 1.0;
-        model.update(gradients, lr);
-        avg_log_prob = model.avg_log_prob(corpus);
+        data = {};
+        data.epoch = e;
+        const double lr = data.lr = learningRate ? (*learningRate)(e) : 1.0;
+        long examples = 0;
+        start = std::chrono::steady_clock::now();
+        if (pool) {
+            examples = pool->epoch(model, lr);
+            data.gradients_seconds = seconds_since(start);
+        } else if (uses_sgd()) {
+            std::vector<std::thread> workers;
+            std::vector<long> shard_examples(threads, 0);
+            for (int t = 0;  t < threads;  ++t) {
+                const long begin = corpus.size() * t / threads;
+                const long end = corpus.size() * (t + 1) / threads;
+                workers.emplace_back(sgd_shard<Model>, std::ref(model), std::cref(corpus), begin, end,
+                                     std::cref(noise), negative, std::cref(keep), lr, std::ref(rngs[t]),
+                                     std::ref(shard_examples[t]));
+            }
+            for (auto& worker : workers)
+                worker.join();
+            for (long n : shard_examples)
+                examples += n;
+            data.gradients_seconds = seconds_since(start);
+        } else {
+            BasicCBOWModelGradients<T> gradients = model.gradients(corpus);
+            examples = gradients.examples;
+            data.gradients_seconds = seconds_since(start);
+            start = std::chrono::steady_clock::now();
+            model.update(gradients, lr);
+            data.update_seconds = seconds_since(start);
+        }
+        const int workers = pool ? processes : uses_sgd() ? threads : 1;
+        const double thread_seconds = std::max(data.gradients_seconds + data.update_seconds, 1e-9) * workers;
+        data.words_per_sec = corpus.size() / thread_seconds;
+        data.examples_per_sec = examples / thread_seconds;
+        start = std::chrono::steady_clock::now();
+        estimate = evaluate();
+        data.avg_log_prob = estimate.avg_log_prob;
+        data.avg_log_prob_error = estimate.error;
+        data.evaluation_seconds = seconds_since(start);
+        bool stop = false;
+        if (estimate.avg_log_prob > best + minDelta) {
+            best = estimate.avg_log_prob;
+            stale = 0;
+        } else {
+            ++stale;
+            stop = patience > 0 && stale >= patience;
+        }
+        if (checkpointer) {
+            const auto now = std::chrono::steady_clock::now();
+            const std::chrono::duration<double> since = now - last_checkpoint;
+            if ((checkpointEpochs > 0 && e % checkpointEpochs == 0)
+                || (checkpointSeconds > 0.0 && since.count() >= checkpointSeconds)) {
+                checkpointer->write(model, {e, best, stale});
+                last_checkpoint = std::chrono::steady_clock::now();
+                data.checkpoint_seconds = seconds_since(now);
+            }
+        }
+        data.peak_rss_kb = peak_rss_kb();
         if (epochReporter)
-            (*epochReporter)({e, avg_log_prob, lr});
-        // TODO: compute loss on validation data
+            (*epochReporter)(data);
+        if (stop)
+            break;
     }
+    start = std::chrono::steady_clock::now();
+    if (checkpointer)
+        checkpointer->wait();
+    data = {-1, estimate.avg_log_prob, data.lr};
+    data.avg_log_prob_error = estimate.error;
+    data.checkpoint_seconds = seconds_since(start);
+    data.peak_rss_kb = peak_rss_kb();
     if (exitReporter)
-        (*exitReporter)({-1, avg_log_prob, lr});
+        (*exitReporter)(data);
     return model;
 }
 
+template FloatCBOWModel Trainer::train<float>(const std::vector<int>& corpus) const;
+template CBOWModel Trainer::train<double>(const std::vector<int>& corpus) const;
+template FloatCBOWModel Trainer::train<float>(const Corpus& corpus) const;
+template CBOWModel Trainer::train<double>(const Corpus& corpus) const;
+template FloatSkipGramModel Trainer::train_skipgram<float>(const std::vector<int>& corpus) const;
+template SkipGramModel Trainer::train_skipgram<double>(const std::vector<int>& corpus) const;
+template FloatSkipGramModel Trainer::train_skipgram<float>(const Corpus& corpus) const;
+template SkipGramModel Trainer::train_skipgram<double>(const Corpus& corpus) const;
+
 } // namespace toynet
@@ -1,7 +1,12 @@
+#include <toynet/corpus.h>
+#include <toynet/ublas/mappable_array.h>
 #include <toynet/ublas/ublas.h>
 #include <iostream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <boost/serialization/access.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/numeric/ublas/matrix.hpp>
 
@@ -14,19 +19,156 @@ namespace toynet {
 // close to the beginning or end of the corpus.
 std::vector<int> get_context(const std::vector<int>& words, int index, int historyN, int futureN);
 
+// Like the previous `get_context` function, but store the context in `out`
+// to avoid allocating a new list for each word.
+void get_context(const std::vector<int>& words, int index, int historyN, int futureN, std::vector<int>& out);
+
+// Like the previous `get_context` function, over a `Corpus`
+void get_context(const Corpus& words, long index, int historyN, int futureN, std::vector<int>& out);
+
+// A row-major matrix that can be used in place over a memory-mapped file
+template<class T>
+using BasicEmbeddingMatrix = ublas::matrix<T, ublas::row_major, MappableArray<T>>;
+
+typedef BasicEmbeddingMatrix<double> EmbeddingMatrix;
+
 // Given two matrices `out` and `gradients` of the same dimensions, modify out such that:
 // out[i][j] -= gradients[i][j] * lr
-void gradient_descent(ublas::matrix<double>& out, const ublas::matrix<double>& gradients, double lr);
+// (instantiated for T = float and T = double)
+template<class T>
+void gradient_descent(ublas::matrix<T>& out, const ublas::matrix<T>& gradients, double lr);
+
+template<class T>
+void gradient_descent(BasicEmbeddingMatrix<T>& out, const ublas::matrix<T>& gradients, double lr);
+
+// A rows x cols matrix where only a few rows are non-zero, e.g. the
+// gradients of the embeddings w.r.t. a few training examples.  Only the
+// touched rows are stored, each of them once: the deltas added to the same
+// row are merged in place.
+template<class T>
+struct BasicSparseRows {
+    BasicSparseRows(int rows=0, int cols=0);
+
+    int size1() const { return rows; }
+    int size2() const { return cols; }
+
+    // The number of stored rows
+    int nnz() const { return ids.size(); }
+
+    // The values of row `i`, a zero row being stored first if `i` was never
+    // touched.  The pointer is invalidated by the next call to `row`.
+    // Pre-conditions: 0 <= i < size1()
+    T* row(int i);
+
+    // The value at (i, j), 0 if row `i` is not stored
+    T operator()(int i, int j) const;
+
+    // Divide every value by `x`
+    BasicSparseRows& operator/=(T x);
+
+    // The equivalent dense matrix
+    ublas::matrix<T> dense() const;
+
+    int rows;
+    int cols;
+    // The ids of the stored rows, in the order they were first touched
+    std::vector<int> ids;
+    // The stored rows, one after the other: row ids[k] starts at values[k * cols]
+    std::vector<T> values;
+    // positions[i] == k if ids[k] == i
+    std::unordered_map<int, int> positions;
+};
+
+typedef BasicSparseRows<double> SparseRows;
+
+// Like the previous `gradient_descent` functions, but only read and update
+// the rows stored in `gradients`
+template<class T>
+void gradient_descent(ublas::matrix<T>& out, const BasicSparseRows<T>& gradients, double lr);
+
+template<class T>
+void gradient_descent(BasicEmbeddingMatrix<T>& out, const BasicSparseRows<T>& gradients, double lr);
+
+// A Huffman tree over a vocabulary of W words, as used by hierarchical softmax
+// (https://arxiv.org/abs/1310.4546).  The tree has W leaves (the words) and
+// W - 1 inner nodes, indexed from 0 to W - 2; the root is inner node W - 2.
+// Frequent words get short paths from the root.
+// The path of each word is stored in a flat layout: the nodes on the path from
+// the root to word `w` are `points[offsets[w]]` ... `points[offsets[w+1] - 1]`,
+// and `codes[j]` is 1 if the path goes to the right child of `points[j]`, 0 if
+// it goes to the left child.
+struct HuffmanTree {
+    HuffmanTree() = default;
+
+    // Build a tree from the word frequencies `counts`, where `counts[w]` is
+    // the number of times word `w` appears in the corpus.
+    // Pre-conditions:
+    // - counts.size() > 0
+    // - For each `c` in `counts`: c >= 0
+    explicit HuffmanTree(const std::vector<long>& counts);
+
+    // The number of words (leaves), or 0 for an empty tree
+    int size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+    // The length of the path from the root to word `w`
+    int depth(int w) const { return offsets[w+1] - offsets[w]; }
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version)
+    {
+        ar & offsets;
+        ar & points;
+        ar & codes;
+    }
+
+    std::vector<int> offsets;
+    std::vector<int> points;
+    std::vector<char> codes;
+};
 
-struct CBOWModelGradients {
-    CBOWModelGradients(int W, int D);
-    ublas::matrix<double> P;
-    ublas::matrix<double> O;
+// Count the number of occurrences of each word in a corpus.
+// Return value: a list of size W, where `ret[w]` is the count of word `w`
+// Pre-conditions:
+// - For each `w` in `words`: 0 <= `w` < W
+std::vector<long> word_counts(const std::vector<int>& words, int W);
+
+// The gradients of the loss w.r.t. P and O.  Only the rows of the words
+// (and, for a hierarchical softmax, of the inner nodes) involved in the loss
+// are stored.
+template<class T>
+struct BasicCBOWModelGradients {
+    BasicCBOWModelGradients(int W, int D);
+    BasicSparseRows<T> P;
+    BasicSparseRows<T> O;
+    // The number of training examples (predictions of a word from a
+    // context) the gradients were computed from
+    long examples;
 };
 
+typedef BasicCBOWModelGradients<double> CBOWModelGradients;
+
+// Scratch space for `CBOWModel::sgd_step`, reused across steps
+template<class T>
+struct BasicSGDWorkspace {
+    BasicSGDWorkspace(int D);
+    ublas::vector<T> avg;  // average embedding of the context words
+    ublas::vector<T> grad_avg;  // d(loss, avg)
+    ublas::vector<double> out;  // output layer, only used by the full softmax
+};
+
+typedef BasicSGDWorkspace<double> SGDWorkspace;
+
 // An implementation of the Continuous Bag-of-Words Model from
 // https://arxiv.org/abs/1301.3781.
-struct CBOWModel {
+// The parameters of the model are stored as scalars of type `T`, which is
+// either `double` (`CBOWModel`) or `float` (`FloatCBOWModel`).  Single
+// precision is enough for word embeddings, and halves the memory used by the
+// model.  Probabilities are always returned as doubles.
+template<class T>
+struct BasicCBOWModel {
+    typedef T value_type;
+    typedef BasicEmbeddingMatrix<T> Matrix;
+
     // Parameters:
     // - W: the number of words in the vocabulary
     // - D: the embedding size
@@ -36,7 +178,18 @@ struct CBOWModel {
     // - W > 0
     // - D > 0
     // - historyN + futureN > 0
-    CBOWModel(int W, int D=50, int historyN=4, int futureN=4);
+    BasicCBOWModel(int W, int D=50, int historyN=4, int futureN=4);
+
+    // Switch the output layer to hierarchical softmax over `tree`.  In that
+    // mode, row `n` of `O` holds the vector of inner node `n` of `tree` (the
+    // last row of `O` is unused), and computing p(word | context) costs
+    // O(D * log(W)) instead of O(D * W).
+    // Pre-conditions:
+    // - tree.size() == W
+    void set_hierarchical(const HuffmanTree& tree);
+
+    // Whether the output layer is a hierarchical softmax
+    bool hierarchical() const { return tree.size() > 0; }
 
     // Save the model to an output stream using Boost serialization
     void save(std::ostream& os) const;
@@ -44,6 +197,33 @@ struct CBOWModel {
     // Load a model from an input stream using Boost serialization
     void load(std::istream& is);
 
+    // Save the model to an output stream in a binary format, made of:
+    // - a 64-byte header: the magic string "TOYNETW2" (8 bytes), the format
+    //   version, the size of a scalar (sizeof(T)), W, D, historyN and
+    //   futureN (4-byte integers each), then the number of inner nodes on all
+    //   the paths of the hierarchical softmax tree (8 bytes, 0 for a full
+    //   softmax)
+    // - P, then O, as raw scalars in row-major order, each starting at an
+    //   offset that is a multiple of 64 bytes
+    // - the hierarchical softmax tree, if any: `tree.offsets` and
+    //   `tree.points` as 4-byte integers, then `tree.codes` as bytes
+    // All values are in native byte order.
+    void save_binary(std::ostream& os) const;
+
+    // Load a model saved with `save_binary` from an input stream.
+    // Throws std::runtime_error if the stream is not in the expected format,
+    // including if the model was saved with a different scalar type.
+    void load_binary(std::istream& is);
+
+    // Load a model saved with `save_binary` by memory-mapping the file at
+    // `path`.  P and O are used in place, without any parsing or copying,
+    // so loading takes constant time regardless of the model size.  The model
+    // keeps the file mapped for as long as it (or a moved-to model) refers to
+    // it; copies of the model own their own memory.  Writing to P or O is
+    // allowed and never modifies the file.
+    // Throws std::runtime_error if the file is not in the expected format.
+    void load_mapped(const std::string& path);
+
     // Return the list of word indices with their associated probability
     // given a list of context word indices.
     // Parameters:
@@ -69,6 +249,30 @@ struct CBOWModel {
     //   - 0 <= `word` < W
     double predict(const std::vector<int>& context, int word) const;
 
+    // Like the first `predict` function, but only returns the `k` most likely
+    // words, without sorting the whole vocabulary.
+    // If `normalize` is false, the softmax normalization is skipped and the
+    // returned scores are the logits of the output layer, which rank the words
+    // like their probabilities (with a hierarchical softmax, the scores are
+    // always probabilities).
+    // Return value: A list of dimension min(k, W) of (probability or logit,
+    //      word index) pairs, sorted descending
+    // Pre-conditions:
+    //   -  k >= 0
+    //   -  For each `i` in `context`: 0 <= `i` < W
+    std::vector<std::pair<double, int>> predict_topk(const std::vector<int>& context, int k, bool normalize=true) const;
+
+    // Like the first `predict` function, but for a batch of contexts, and
+    // without sorting the probabilities.  All the output layers are computed
+    // with a single matrix product, which is much faster than computing each
+    // of them separately.
+    // Return value: A matrix of dimension contexts.size() x W, where
+    //      ret(b, i) is the probability of word index `i` given `contexts[b]`
+    // Pre-conditions:
+    //   -  For each `context` in `contexts`: !context.empty()
+    //   -  For each `i` in each `context`: 0 <= `i` < W
+    ublas::matrix<T> predict_batch(const std::vector<std::vector<int>>& contexts) const;
+
     // Helper function for `predict` methods above
     ublas::vector<double> predict_helper(const std::vector<int>& context) const;
 
@@ -76,17 +280,51 @@ struct CBOWModel {
     // in https://arxiv.org/abs/1310.4546:
     //     1/T * sum{t=1, T}(log(p(w_t | context)))
     // where T is the size of `words`.
+    // Words without any context word are skipped (but still count in T).
+    // The corpus is split into `threads` contiguous chunks evaluated in
+    // parallel.  Within a chunk, the sum of the context embeddings is updated
+    // as the context window slides, and no memory is allocated per word.
     // Parameters:
     //   - words: the corpus, a list of word indices
+    //   - threads: the number of threads
+    // Pre-conditions:
+    //   - For each `w` in `words`: 0 <= `w` < W
+    //   - threads > 0
+    double avg_log_prob(const std::vector<int>& words, int threads=1) const;
+
+    // Like the previous `avg_log_prob` function, over a `Corpus`
+    double avg_log_prob(const Corpus& words, int threads=1) const;
+
+    // Compute the gradients of the loss function w.r.t. P and O over the
+    // corpus `words`.  The loss is the negative of `avg_log_prob(words)`.
+    // Words without any context word are skipped.
     // Pre-conditions:
     //   - For each `w` in `words`: 0 <= `w` < W
-    double avg_log_prob(const std::vector<int>& words) const;
+    BasicCBOWModelGradients<T> gradients(const std::vector<int>& words) const;
 
-    // Compute gradients of loss function w.r.t. P and O
-    CBOWModelGradients gradients() const;
+    BasicCBOWModelGradients<T> gradients(const Corpus& words) const;
 
     // Given gradients and a learning rate, update the matrices P and O
-    void update(const CBOWModelGradients& gradients, double lr);
+    void update(const BasicCBOWModelGradients<T>& gradients, double lr);
+
+    // Perform one step of online stochastic gradient descent on the loss of
+    // predicting `word` from `context`.  The loss is one of:
+    //   - the hierarchical softmax loss, if hierarchical()
+    //   - the negative sampling loss with noise words `negatives`
+    //     (https://arxiv.org/abs/1310.4546), if `negatives` is not empty;
+    //     noise words equal to `word` are ignored
+    //   - the full softmax loss, if neither of the above applies
+    // The first two are exclusive: row n of O is the vector of inner node n
+    // with a hierarchical softmax, and the output vector of word n with
+    // negative sampling, so combining them would mix two sets of parameters.
+    // Only the rows of P of the context words and the rows of O of the inner
+    // nodes or the (noise) words involved in the loss are read and updated.
+    // Pre-conditions:
+    //   - !hierarchical() || negatives.empty()
+    //   - !context.empty()
+    //   - For each `i` in `context` and `negatives`: 0 <= `i` < W
+    //   - 0 <= `word` < W
+    void sgd_step(const std::vector<int>& context, int word, const std::vector<int>& negatives, double lr, BasicSGDWorkspace<T>& ws);
 
     friend class boost::serialization::access;
 
@@ -99,6 +337,8 @@ struct CBOWModel {
         ar & futureN;
         ar & P;
         ar & O;
+        if (version >= 1)
+            ar & tree;
     }
 
     int W;
@@ -108,17 +348,137 @@ struct CBOWModel {
     // The matrix between the input layer and the projection layer
     // P[word_index][projection_layer_index]
     // (i.e. the words embeddings)
-    ublas::matrix<double> P;
+    Matrix P;
     // The matrix between the projection layer and the output layer
     // P[word_index][projection_layer_index]
     // (i.e. used to predict most likely words)
-    ublas::matrix<double> O;
+    Matrix O;
+    // The Huffman tree of the hierarchical softmax; empty for a full softmax
+    HuffmanTree tree;
+};
+
+typedef BasicCBOWModel<double> CBOWModel;
+typedef BasicCBOWModel<float> FloatCBOWModel;
+
+// An implementation of the Continuous Skip-gram Model from
+// https://arxiv.org/abs/1301.3781, which predicts each context word from the
+// current word.  It has the same parameters, serialization and binary
+// format as `CBOWModel`, and is trained with the same kernels: like the
+// word2vec implementation, each (current word, context word) pair is used as
+// an example predicting the current word from the context word alone, i.e.
+// a CBOW example with a single context word.  Both directions give the same
+// pairs when historyN == futureN.  Skip-gram is slower to train than CBOW
+// (one example per context word instead of one per position), but gives
+// better embeddings for rare words.
+template<class T>
+struct BasicSkipGramModel : public BasicCBOWModel<T> {
+    // See `CBOWModel::CBOWModel`
+    BasicSkipGramModel(int W, int D=50, int historyN=4, int futureN=4);
+
+    using BasicCBOWModel<T>::predict;
+    using BasicCBOWModel<T>::predict_topk;
+    using BasicCBOWModel<T>::predict_batch;
+
+    // The probabilities of the words around `word`, i.e. `predict({word})`
+    std::vector<std::pair<double, int>> predict(int word) const;
+
+    // See `CBOWModel::predict_topk`
+    std::vector<std::pair<double, int>> predict_topk(int word, int k, bool normalize=true) const;
+
+    // Like `CBOWModel::predict_batch`, with a single context word per row
+    ublas::matrix<T> predict_batch(const std::vector<int>& words) const;
+
+    // Given a corpus `words`, compute the average log probability, as defined
+    // in https://arxiv.org/abs/1310.4546:
+    //     1/T * sum{t=1, T}(sum{c in context(t)}(log(p(w_t | c))))
+    // See `CBOWModel::avg_log_prob` for the parameters.
+    double avg_log_prob(const std::vector<int>& words, int threads=1) const;
+
+    double avg_log_prob(const Corpus& words, int threads=1) const;
+
+    // Compute the gradients of the loss function w.r.t. P and O over the
+    // corpus `words`.  The loss is the negative of `avg_log_prob(words)`.
+    BasicCBOWModelGradients<T> gradients(const std::vector<int>& words) const;
+
+    BasicCBOWModelGradients<T> gradients(const Corpus& words) const;
+};
+
+typedef BasicSkipGramModel<double> SkipGramModel;
+typedef BasicSkipGramModel<float> FloatSkipGramModel;
+
+// An estimate of the average log probability of a corpus (see
+// `CBOWModel::avg_log_prob`), computed from a random sample of its positions
+struct LogProbEstimate {
+    // The estimated average log probability
+    double avg_log_prob;
+    // The half-width of the 95% confidence interval of `avg_log_prob`,
+    // i.e. 1.96 times its standard error; 0 when every position was used
+    double error;
+    // The number of positions used
+    long samples;
 };
 
+// Estimate `model.avg_log_prob(words)` from `samples` positions drawn
+// uniformly at random (with replacement) using the seed `seed`.  This costs
+// O(samples) instead of O(T) log probabilities, and the same seed always
+// draws the same positions, so that the estimates of two models (e.g. of
+// the same model after two epochs) are paired and can be compared with
+// less noise than their confidence intervals suggest.  If
+// samples >= words.size(), every position is used once and the result is
+// exact.
+// Pre-conditions:
+//   - samples > 0
+//   - !words.empty()
+//   - For each `w` in `words`: 0 <= `w` < W
+template<class Model>
+LogProbEstimate estimate_avg_log_prob(const Model& model, const Corpus& words, long samples, unsigned int seed=0);
+
+// The state of a training run saved in a checkpoint besides the model, see
+// `Trainer::setCheckpoint`
+struct CheckpointState {
+    // The last completed epoch; the learning rate is a function of it
+    int epoch;
+    // Early stopping: the best `avg_log_prob` so far, and the number of
+    // epochs in a row without improvement
+    double best_avg_log_prob;
+    int stale_epochs;
+};
+
+// Save a checkpoint of `model` and `state` to the file at `path`.  The
+// checkpoint is written to `path` + ".tmp" first, which is then renamed to
+// `path`, so that `path` always holds a complete checkpoint even if the
+// process dies while writing.  The model is stored with `save_binary`.
+template<class Model>
+void save_checkpoint(const std::string& path, const Model& model, const CheckpointState& state);
+
+// Load a checkpoint saved with `save_checkpoint` into `model`
+template<class Model>
+CheckpointState load_checkpoint(const std::string& path, Model& model);
+
 struct ReportData {
     int epoch;
     double avg_log_prob;
     double lr;
+    // Training throughput of the epoch, in corpus words per second per
+    // thread; 0 when not measured
+    double words_per_sec;
+    // Half-width of the 95% confidence interval of `avg_log_prob` when it
+    // is estimated from a sample (see `LogProbEstimate`); 0 when exact
+    double avg_log_prob_error;
+    // Training throughput of the epoch, in training examples (predictions of
+    // a word from a context) per second per thread; 0 when not measured.
+    // Unlike words, examples account for subsampling and skip-gram pairs.
+    double examples_per_sec;
+    // Wall-clock time of each phase, in seconds.  Online SGD computes the
+    // gradients and updates the model in the same pass, which is timed as
+    // `gradients_seconds`.  `checkpoint_seconds` is the time training was
+    // blocked to copy the model (or wait for the previous checkpoint).
+    double gradients_seconds;
+    double update_seconds;
+    double evaluation_seconds;
+    double checkpoint_seconds;
+    // Peak resident set size of the process so far, in kilobytes
+    long peak_rss_kb;
 };
 
 struct Reporter {
@@ -131,6 +491,15 @@ struct SimpleReporter : public Reporter {
     std::ostream& os;
 };
 
+// Writes each report as a JSON object on its own line, with one member per
+// field of `ReportData`, e.g. to graph them.  Non-finite numbers are written
+// as null.
+struct JsonLinesReporter : public Reporter {
+    JsonLinesReporter(std::ostream& os);
+    virtual void operator()(const ReportData& data) const override;
+    std::ostream& os;
+};
+
 struct LearningRate {
     virtual double operator()(int epoch) const = 0;
 };
@@ -164,13 +533,155 @@ struct Trainer {
 
     Trainer& setLearningRate(const LearningRate *learningRate);
 
+    // Use a hierarchical softmax built from the corpus word frequencies
+    // instead of a full softmax
+    Trainer& setHierarchicalSoftmax(bool hierarchical);
+
+    // Number of noise words drawn per corpus position for negative sampling;
+    // 0 disables negative sampling.  Negative sampling trains the model with
+    // online SGD (one `CBOWModel::sgd_step` per corpus position) instead of
+    // full-batch gradient descent, with noise words drawn from the unigram
+    // distribution raised to the power 3/4.  It cannot be combined with
+    // `setHierarchicalSoftmax(true)` (see `CBOWModel::sgd_step`): `train`
+    // throws std::runtime_error if both are set.
+    Trainer& setNegative(int negative);
+
+    // Train with online SGD (one `CBOWModel::sgd_step` per corpus position)
+    // instead of full-batch gradient descent.  Negative sampling always
+    // trains online.
+    Trainer& setOnline(bool online);
+
+    // Number of threads used by online SGD and to evaluate the model after
+    // each epoch.  For online SGD, the corpus is split into
+    // `threads` contiguous shards, and each thread runs SGD over its shard.
+    // The threads update the shared model without any locking
+    // (Hogwild!, https://arxiv.org/abs/1106.5730): updates from different
+    // threads may occasionally overwrite each other, which is harmless since
+    // each step only touches a few rows of the model.
+    // Pre-conditions: threads > 0
+    Trainer& setThreads(int threads);
+
+    // Subsample frequent words with threshold `sample` (see
+    // `keep_probabilities`): in each epoch, each occurrence of a frequent
+    // word is discarded at random before building the contexts, so frequent
+    // words are trained on less often, and the remaining words get wider
+    // effective contexts.  Typical values are 1e-3 to 1e-5; 0 disables
+    // subsampling.  Subsampling always trains online.
+    Trainer& setSample(double sample);
+
+    // Train with online SGD in `processes` worker processes instead of
+    // threads, for `processes` > 1.  Each worker is forked at the beginning
+    // of training and trains its own replica of the model on a contiguous
+    // shard of the corpus.  After every `syncInterval` positions of its
+    // shard, each worker publishes its replica to a shared-memory segment
+    // owned by the training process, which averages the replicas and sends
+    // the average back to the workers.  A worker that dies is left out of the
+    // averages and its shard is no longer trained on; training only fails if
+    // every worker dies.  `threads` is then only used for evaluation.
+    // The workers are forked and then run allocating code, which is only safe
+    // in a single-threaded process: no other thread may be running in the
+    // process when `train` is called with `processes` > 1.
+    // Pre-conditions: processes > 0, syncInterval > 0
+    Trainer& setProcesses(int processes, long syncInterval=100000);
+
+    // Seed of the random number generator used to initialize the model, to
+    // draw noise words and to subsample words
+    Trainer& setSeed(unsigned int seed);
+
+    // Held-out corpus on which the model is evaluated before training and
+    // after each epoch, instead of the training corpus; the reported
+    // `avg_log_prob` is then the one of `validation`.  An empty corpus (the
+    // default) evaluates on the training corpus.  Like any `Corpus`,
+    // `validation` does not own its words, which must outlive the trainer.
+    // Pre-conditions: validation.W <= the W of the training corpus
+    Trainer& setValidation(const Corpus& validation);
+
+    // A temporary vector would not outlive the trainer
+    Trainer& setValidation(std::vector<int>&& validation) = delete;
+
+    // Evaluate the model on `samples` random positions of the evaluation
+    // corpus (see `estimate_avg_log_prob`) instead of all of them, which
+    // removes the full pass over the corpus from each epoch.  The same
+    // positions are used for every evaluation.  0 (the default) evaluates
+    // the model exactly.
+    // Pre-conditions: samples >= 0
+    Trainer& setValidationSamples(long samples);
+
+    // Stop training early when the evaluation `avg_log_prob` has not improved
+    // on its best value by more than `minDelta` for `patience` epochs in a
+    // row.  The model of the last epoch is returned.  0 (the default)
+    // disables early stopping.
+    // Pre-conditions: patience >= 0, minDelta >= 0
+    Trainer& setEarlyStopping(int patience, double minDelta=0.0);
+
+    // Save a checkpoint (see `save_checkpoint`) to `path` after every
+    // `everyEpochs` epochs, and after any epoch ending at least
+    // `everySeconds` seconds after the last checkpoint; 0 disables either
+    // criterion, and an empty path disables checkpointing.  The model is
+    // copied into a second buffer and written by a background thread while
+    // training goes on; if the previous checkpoint is still being written,
+    // training waits for it first.
+    // Pre-conditions: everyEpochs >= 0, everySeconds >= 0
+    Trainer& setCheckpoint(const std::string& path, int everyEpochs=1, double everySeconds=0.0);
+
+    // If the checkpoint file set with `setCheckpoint` exists, resume training
+    // from it: the model, the epoch (and so the learning rate) and the early
+    // stopping state are restored, and training goes on until `epochs`.  The
+    // random number generators are not restored, so with online SGD the
+    // resumed run differs from an uninterrupted one.
+    // `train` throws std::runtime_error if the checkpoint does not match the
+    // corpus or the settings: number of words, embedding size, historyN,
+    // futureN and hierarchical softmax tree.
+    Trainer& setResume(bool resume);
+
+    // Train a model with scalars of type `T` (float or double) on `corpus`
+    // Pre-conditions: corpus.size() > 0
+    template<class T=double>
+    BasicCBOWModel<T> train(const std::vector<int>& corpus) const;
+
+    // Like the previous `train` function, over a `Corpus`, e.g. a
+    // memory-mapped corpus file.  W and the word frequencies are taken from
+    // the corpus, and the corpus is only ever read in place.
+    // Throws std::runtime_error if a word index of the corpus (or of the
+    // validation corpus) is not in [0, W).
     // Pre-conditions: corpus.size() > 0
-    CBOWModel train(const std::vector<int>& corpus) const;
+    template<class T=double>
+    BasicCBOWModel<T> train(const Corpus& corpus) const;
+
+    // Like the `train` functions, but train a skip-gram model
+    template<class T=double>
+    BasicSkipGramModel<T> train_skipgram(const std::vector<int>& corpus) const;
+
+    template<class T=double>
+    BasicSkipGramModel<T> train_skipgram(const Corpus& corpus) const;
+
+    // Helper function for the `train` functions above
+    template<class Model>
+    Model train_model(const Corpus& corpus) const;
+
+    // Whether `train` uses online SGD
+    bool uses_sgd() const { return online || negative > 0 || sample > 0.0 || processes > 1; }
 
     int epochs;
     int D;
     int historyN;
     int futureN;
+    bool hierarchical;
+    int negative;
+    bool online;
+    int threads;
+    double sample;
+    int processes;
+    long syncInterval;
+    unsigned int seed;
+    Corpus validation;
+    long validationSamples;
+    int patience;
+    double minDelta;
+    std::string checkpointPath;
+    int checkpointEpochs;
+    double checkpointSeconds;
+    bool resume;
     const Reporter *initReporter;
     const Reporter *epochReporter;
     const Reporter *exitReporter;
@@ -178,3 +689,8 @@ struct Trainer {
 };
 
 } // namespace toynet
+
+BOOST_CLASS_VERSION(toynet::CBOWModel, 1)
+BOOST_CLASS_VERSION(toynet::FloatCBOWModel, 1)
+BOOST_CLASS_VERSION(toynet::SkipGramModel, 1)
+BOOST_CLASS_VERSION(toynet::FloatSkipGramModel, 1)
@@ -1,10 +1,19 @@
 #include <toynet/w2v.h>
+#include <toynet/vocab.h>
 #define BOOST_TEST_MODULE toynet
 #include <toynet/stlio.h>
 #include <toynet/ublas/convert.h>
 #include <toynet/ublas/io.h>
 #include <toynet/ublas/test.h>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <set>
+#include <signal.h>
+#include <unistd.h>
 #include <boost/test/unit_test.hpp>
 
 using namespace toynet;
@@ -26,6 +35,50 @@ BOOST_AUTO_TEST_CASE(get_context_6)
     BOOST_CHECK_EQUAL(expected6, get_context(words, 9, 3, 3));
 }
 
+BOOST_AUTO_TEST_CASE(SparseRows_row)
+{
+    SparseRows rows(5, 2);
+    BOOST_CHECK_EQUAL(0, rows.nnz());
+    rows.row(3)[1] = 2.0;
+    rows.row(0)[0] = -1.0;
+    rows.row(3)[1] += 4.0;  // merged into the same row
+    BOOST_CHECK_EQUAL(2, rows.nnz());
+    BOOST_CHECK_EQUAL(std::vector<int>({3, 0}), rows.ids);
+    BOOST_CHECK_EQUAL(6.0, rows(3, 1));
+    BOOST_CHECK_EQUAL(0.0, rows(3, 0));
+    BOOST_CHECK_EQUAL(0.0, rows(4, 1));
+    rows /= 2.0;
+    ublas::matrix<double> expected = ublas::zero_matrix<double>(5, 2);
+    expected(3, 1) = 3.0;
+    expected(0, 0) = -0.5;
+    BOOST_CHECK(ublas::norm_frobenius(expected - rows.dense()) == 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(gradient_descent_sparse)
+{
+    EmbeddingMatrix m(3, 2);
+    std::fill(m.data().begin(), m.data().end(), 1.0);
+    SparseRows g(3, 2);
+    g.row(2)[0] = 4.0;
+    g.row(2)[1] = -2.0;
+    gradient_descent(m, g, 0.5);
+    BOOST_CHECK_EQUAL(1.0, m(0, 0));
+    BOOST_CHECK_EQUAL(1.0, m(1, 1));
+    BOOST_CHECK_EQUAL(-1.0, m(2, 0));
+    BOOST_CHECK_EQUAL(2.0, m(2, 1));
+}
+
+BOOST_AUTO_TEST_CASE(get_context_corpus)
+{
+    const std::vector<int> words{78, 333, 0, 99, 15, 4, 2, 2, 78, 99};
+    const Corpus corpus(words);
+    std::vector<int> got;
+    for (int i = 0;  i < words.size();  ++i) {
+        get_context(corpus, i, 3, 2, got);
+        BOOST_CHECK_EQUAL(get_context(words, i, 3, 2), got);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(gradient_descent_2_by_2)
 {
     ublas::matrix<double> m(2, 2);
@@ -45,6 +98,42 @@ BOOST_AUTO_TEST_CASE(gradient_descent_2_by_2)
     BOOST_CHECK_EQUAL(-18.25, m(1, 1)); // -19.5 - (-2.5 * 0.5)
 }
 
+BOOST_AUTO_TEST_CASE(word_counts_4)
+{
+    const std::vector<int> words{0, 2, 0, 1, 1, 2, 0};
+    const std::vector<long> expected{3, 2, 2, 0};
+    BOOST_CHECK_EQUAL(expected, word_counts(words, 4));
+}
+
+BOOST_AUTO_TEST_CASE(HuffmanTree_W1)
+{
+    HuffmanTree tree({7});
+    BOOST_CHECK_EQUAL(1, tree.size());
+    BOOST_CHECK_EQUAL(0, tree.depth(0));
+    BOOST_CHECK(tree.points.empty());
+}
+
+BOOST_AUTO_TEST_CASE(HuffmanTree_W6)
+{
+    // https://en.wikipedia.org/wiki/Huffman_coding (CLRS example)
+    HuffmanTree tree({5, 9, 12, 13, 16, 45});
+    BOOST_REQUIRE_EQUAL(6, tree.size());
+    const std::vector<int> depths{4, 4, 3, 3, 3, 1};
+    for (int w = 0;  w < 6;  ++w)
+        BOOST_CHECK_EQUAL(depths[w], tree.depth(w));
+    // All paths start at the root, and inner nodes are in range
+    for (int w = 0;  w < 6;  ++w) {
+        BOOST_CHECK_EQUAL(4, tree.points[tree.offsets[w]]);
+        for (int j = tree.offsets[w];  j < tree.offsets[w+1];  ++j)
+            BOOST_CHECK(tree.points[j] >= 0 && tree.points[j] < 5);
+    }
+    // Each word has a distinct code
+    std::set<std::vector<char>> codes;
+    for (int w = 0;  w < 6;  ++w)
+        codes.insert(std::vector<char>(tree.codes.begin() + tree.offsets[w], tree.codes.begin() + tree.offsets[w+1]));
+    BOOST_CHECK_EQUAL(6, codes.size());
+}
+
 BOOST_AUTO_TEST_CASE(CBOWModel_constructor_W1_defaults)
 {
     CBOWModel model(1);
@@ -107,6 +196,43 @@ BOOST_AUTO_TEST_CASE(CBOWModel_save_load)
     BOOST_CHECK_EQUAL(4, model2.P.size2());
     BOOST_CHECK_EQUAL(3, model2.O.size1());
     BOOST_CHECK_EQUAL(4, model2.O.size2());
+    BOOST_CHECK(!model2.hierarchical());
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_save_load_hierarchical)
+{
+    CBOWModel model(3, 4, 5, 6);
+    model.set_hierarchical(HuffmanTree({3, 1, 2}));
+    std::stringstream ss;
+    model.save(ss);
+    CBOWModel model2(1);
+    model2.load(ss);
+    BOOST_CHECK(model2.hierarchical());
+    BOOST_CHECK_EQUAL(model.tree.offsets, model2.tree.offsets);
+    BOOST_CHECK_EQUAL(model.tree.points, model2.tree.points);
+    BOOST_CHECK(model.tree.codes == model2.tree.codes);
+}
+
+template<class T>
+void check_equal_models(const BasicCBOWModel<T>& expected, const BasicCBOWModel<T>& got)
+{
+    BOOST_CHECK_EQUAL(expected.W, got.W);
+    BOOST_CHECK_EQUAL(expected.D, got.D);
+    BOOST_CHECK_EQUAL(expected.historyN, got.historyN);
+    BOOST_CHECK_EQUAL(expected.futureN, got.futureN);
+    BOOST_REQUIRE_EQUAL(expected.P.size1(), got.P.size1());
+    BOOST_REQUIRE_EQUAL(expected.P.size2(), got.P.size2());
+    BOOST_REQUIRE_EQUAL(expected.O.size1(), got.O.size1());
+    BOOST_REQUIRE_EQUAL(expected.O.size2(), got.O.size2());
+    for (int i = 0;  i < expected.P.size1();  ++i) {
+        for (int j = 0;  j < expected.P.size2();  ++j) {
+            BOOST_CHECK_EQUAL(expected.P(i, j), got.P(i, j));
+            BOOST_CHECK_EQUAL(expected.O(i, j), got.O(i, j));
+        }
+    }
+    BOOST_CHECK_EQUAL(expected.tree.offsets, got.tree.offsets);
+    BOOST_CHECK_EQUAL(expected.tree.points, got.tree.points);
+    BOOST_CHECK(expected.tree.codes == got.tree.codes);
 }
 
 CBOWModel get_model()
@@ -150,6 +276,66 @@ CBOWModel get_model()
     return model;
 }
 
+BOOST_AUTO_TEST_CASE(CBOWModel_save_load_binary)
+{
+    CBOWModel model = get_model();
+    for (bool hierarchical : {false, true}) {
+        if (hierarchical)
+            model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+        std::stringstream ss;
+        model.save_binary(ss);
+        CBOWModel model2(1);
+        model2.load_binary(ss);
+        check_equal_models(model, model2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_load_binary_errors)
+{
+    CBOWModel model(1);
+    std::stringstream ss("not a model");
+    BOOST_CHECK_THROW(model.load_binary(ss), std::runtime_error);
+    std::stringstream ss2;
+    get_model().save_binary(ss2);
+    std::stringstream truncated(ss2.str().substr(0, 100));
+    BOOST_CHECK_THROW(model.load_binary(truncated), std::runtime_error);
+    // Truncated in the tree section: the model is left unchanged
+    CBOWModel hierarchical = get_model();
+    hierarchical.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    std::stringstream ss3;
+    hierarchical.save_binary(ss3);
+    const std::string bytes = ss3.str();
+    model = get_model();
+    std::stringstream truncated_tree(bytes.substr(0, bytes.size() - 1));
+    BOOST_CHECK_THROW(model.load_binary(truncated_tree), std::runtime_error);
+    check_equal_models(get_model(), model);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_load_mapped)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_CBOWModel_load_mapped").string();
+    CBOWModel model = get_model();
+    model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    {
+        std::ofstream os(path, std::ios::binary);
+        model.save_binary(os);
+    }
+    CBOWModel mapped(1);
+    mapped.load_mapped(path);
+    std::remove(path.c_str());  // the mapping outlives the file name
+    BOOST_CHECK(mapped.P.data().mapped());
+    BOOST_CHECK(mapped.O.data().mapped());
+    check_equal_models(model, mapped);
+    BOOST_CHECK_EQUAL(model.predict({1, 1, 0}), mapped.predict({1, 1, 0}));
+    // copies own their memory, and writes do not affect the original
+    CBOWModel copy = mapped;
+    BOOST_CHECK(!copy.P.data().mapped());
+    copy.P(0, 0) = 42.0;
+    BOOST_CHECK_EQUAL(model.P(0, 0), mapped.P(0, 0));
+    mapped.P(0, 1) = 43.0;
+    BOOST_CHECK_EQUAL(43.0, mapped.P(0, 1));
+}
+
 BOOST_AUTO_TEST_CASE(CBOWModel_predict_context_1)
 {
     CBOWModel model = get_model();
@@ -221,6 +407,351 @@ BOOST_AUTO_TEST_CASE(CBOWModel_avg_log_prob)
     // std::cout << log_p << std::endl;
 }
 
+// The definition of `avg_log_prob`
+double naive_avg_log_prob(const CBOWModel& model, const std::vector<int>& words)
+{
+    double sum = 0.0;
+    for (int i = 0;  i < words.size();  ++i) {
+        std::vector<int> context = get_context(words, i, model.historyN, model.futureN);
+        if (!context.empty())
+            sum += std::log(model.predict(context, words[i]));
+    }
+    return sum / words.size();
+}
+
+void help_test_avg_log_prob(CBOWModel& model)
+{
+    const std::vector<int> words{0, 2, 0, 1, 1, 2, 0, 3, 3, 1, 2};
+    for (int historyN : {0, 1, 2, 5})
+    for (int futureN : {0, 1, 3, 20}) {
+        if (historyN + futureN == 0)
+            continue;
+        model.historyN = historyN;
+        model.futureN = futureN;
+        const double expected = naive_avg_log_prob(model, words);
+        for (int threads : {1, 2, 3, 11})
+            BOOST_CHECK_CLOSE(expected, model.avg_log_prob(words, threads), 1e-10);
+    }
+    BOOST_CHECK_EQUAL(0.0, model.avg_log_prob({3}));
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_avg_log_prob_sliding_window)
+{
+    CBOWModel model = get_model();
+    help_test_avg_log_prob(model);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_avg_log_prob_hierarchical)
+{
+    CBOWModel model = get_model();
+    model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    help_test_avg_log_prob(model);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_predict_hierarchical)
+{
+    CBOWModel model = get_model();
+    model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    std::vector<std::pair<double, int>> prediction = model.predict({1, 1, 0});
+    BOOST_CHECK_EQUAL(4, prediction.size());
+    double sum = 0;
+    for (const auto& pred : prediction) {
+        sum += pred.first;
+        BOOST_CHECK_CLOSE(pred.first, model.predict({1, 1, 0}, pred.second), 1e-10);
+    }
+    BOOST_CHECK_CLOSE(sum, 1.0, 1e-12);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_predict_topk)
+{
+    CBOWModel model = get_model();
+    const std::vector<std::pair<double, int>> expected = model.predict({1, 1, 0});
+    for (int k = 0;  k <= 5;  ++k) {
+        const std::vector<std::pair<double, int>> got = model.predict_topk({1, 1, 0}, k);
+        BOOST_REQUIRE_EQUAL(std::min(k, 4), got.size());
+        for (int i = 0;  i < got.size();  ++i) {
+            BOOST_CHECK_EQUAL(expected[i].second, got[i].second);
+            BOOST_CHECK_CLOSE(expected[i].first, got[i].first, 1e-10);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_predict_topk_logits)
+{
+    CBOWModel model = get_model();
+    const std::vector<std::pair<double, int>> got = model.predict_topk({1}, 2, false);
+    // see CBOWModel_predict_context_1
+    BOOST_REQUIRE_EQUAL(2, got.size());
+    BOOST_CHECK_EQUAL(3, got[0].second);
+    BOOST_CHECK_CLOSE(0.3476, got[0].first, 1e-10);
+    BOOST_CHECK_EQUAL(2, got[1].second);
+    BOOST_CHECK_CLOSE(0.0462, got[1].first, 1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_predict_topk_hierarchical)
+{
+    CBOWModel model = get_model();
+    model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    const std::vector<std::pair<double, int>> expected = model.predict({1, 1, 0});
+    const std::vector<std::pair<double, int>> got = model.predict_topk({1, 1, 0}, 2, false);
+    BOOST_REQUIRE_EQUAL(2, got.size());
+    for (int i = 0;  i < 2;  ++i) {
+        BOOST_CHECK_EQUAL(expected[i].second, got[i].second);
+        BOOST_CHECK_CLOSE(expected[i].first, got[i].first, 1e-10);
+    }
+}
+
+void help_test_predict_batch(const CBOWModel& model)
+{
+    const std::vector<std::vector<int>> contexts{{1}, {1, 1, 0}, {3, 2}, {0, 1, 2, 3}, {2}};
+    const ublas::matrix<double> got = model.predict_batch(contexts);
+    BOOST_REQUIRE_EQUAL(5, got.size1());
+    BOOST_REQUIRE_EQUAL(4, got.size2());
+    for (int b = 0;  b < contexts.size();  ++b)
+        for (int i = 0;  i < 4;  ++i)
+            BOOST_CHECK_CLOSE(model.predict(contexts[b], i), got(b, i), 1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_predict_batch)
+{
+    CBOWModel model = get_model();
+    help_test_predict_batch(model);
+    BOOST_CHECK_EQUAL(0, model.predict_batch({}).size1());
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_predict_batch_hierarchical)
+{
+    CBOWModel model = get_model();
+    model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    help_test_predict_batch(model);
+}
+
+// Round the parameters of `model` to single precision
+FloatCBOWModel to_float(const CBOWModel& model)
+{
+    FloatCBOWModel ret(model.W, model.D, model.historyN, model.futureN);
+    std::copy(model.P.data().begin(), model.P.data().end(), ret.P.data().begin());
+    std::copy(model.O.data().begin(), model.O.data().end(), ret.O.data().begin());
+    ret.tree = model.tree;
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(FloatCBOWModel_predict)
+{
+    CBOWModel model = get_model();
+    const std::vector<int> words{0, 1, 2, 3, 3, 2, 1, 0, 2};
+    const std::vector<std::vector<int>> contexts{{1}, {1, 1, 0}, {3, 2}};
+    for (bool hierarchical : {false, true}) {
+        if (hierarchical)
+            model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+        const FloatCBOWModel fmodel = to_float(model);
+        const ublas::matrix<float> batch = fmodel.predict_batch(contexts);
+        for (int b = 0;  b < contexts.size();  ++b) {
+            for (int i = 0;  i < 4;  ++i) {
+                BOOST_CHECK_CLOSE(model.predict(contexts[b], i), fmodel.predict(contexts[b], i), 1e-4);
+                BOOST_CHECK_CLOSE(model.predict(contexts[b], i), batch(b, i), 1e-4);
+            }
+        }
+        BOOST_CHECK_CLOSE(model.avg_log_prob(words), fmodel.avg_log_prob(words), 1e-4);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(FloatCBOWModel_save_load)
+{
+    CBOWModel model = get_model();
+    model.set_hierarchical(HuffmanTree({3, 2, 2, 1}));
+    const FloatCBOWModel fmodel = to_float(model);
+    std::stringstream ss;
+    fmodel.save(ss);
+    FloatCBOWModel fmodel2(1);
+    fmodel2.load(ss);
+    check_equal_models(fmodel, fmodel2);
+    // The binary format records the size of a scalar
+    std::stringstream ss2;
+    fmodel.save_binary(ss2);
+    FloatCBOWModel fmodel3(1);
+    fmodel3.load_binary(ss2);
+    check_equal_models(fmodel, fmodel3);
+    ss2.seekg(0);
+    CBOWModel model2(1);
+    BOOST_CHECK_THROW(model2.load_binary(ss2), std::runtime_error);
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_FloatCBOWModel_save_load").string();
+    {
+        std::ofstream os(path, std::ios::binary);
+        fmodel.save_binary(os);
+    }
+    FloatCBOWModel mapped(1);
+    mapped.load_mapped(path);
+    std::remove(path.c_str());
+    BOOST_CHECK(mapped.P.data().mapped());
+    check_equal_models(fmodel, mapped);
+}
+
+// Compare `gradients` against finite differences of `avg_log_prob`
+template<class Model>
+void help_test_gradients(Model& model, const std::vector<int>& words)
+{
+    const CBOWModelGradients g = model.gradients(words);
+    const double eps = 1e-6;
+    for (EmbeddingMatrix* m : {&model.P, &model.O}) {
+        const SparseRows& expected = (m == &model.P) ? g.P : g.O;
+        for (int i = 0;  i < m->size1();  ++i) {
+            for (int j = 0;  j < m->size2();  ++j) {
+                const double x = (*m)(i, j);
+                (*m)(i, j) = x + eps;
+                const double up = -model.avg_log_prob(words);
+                (*m)(i, j) = x - eps;
+                const double down = -model.avg_log_prob(words);
+                (*m)(i, j) = x;
+                BOOST_CHECK_SMALL(expected(i, j) - (up - down) / (2 * eps), 1e-6);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_gradients_softmax)
+{
+    CBOWModel model = get_model();
+    help_test_gradients(model, {0, 2, 0, 1, 1, 2, 0, 3});
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_gradients_hierarchical)
+{
+    CBOWModel model = get_model();
+    const std::vector<int> words{0, 2, 0, 1, 1, 2, 0, 3};
+    model.set_hierarchical(HuffmanTree(word_counts(words, 4)));
+    help_test_gradients(model, words);
+}
+
+SkipGramModel get_skipgram_model()
+{
+    SkipGramModel model(4, 3, 2, 2);
+    static_cast<CBOWModel&>(model) = get_model();
+    return model;
+}
+
+BOOST_AUTO_TEST_CASE(SkipGramModel_predict)
+{
+    const SkipGramModel model = get_skipgram_model();
+    BOOST_CHECK_EQUAL(model.predict(std::vector<int>{2}), model.predict(2));
+    BOOST_CHECK_EQUAL(model.predict_topk(std::vector<int>{2}, 2), model.predict_topk(2, 2));
+    const ublas::matrix<double> batch = model.predict_batch(std::vector<int>{3, 1});
+    BOOST_REQUIRE_EQUAL(2, batch.size1());
+    for (int i = 0;  i < 4;  ++i)
+        BOOST_CHECK_CLOSE(model.predict({1}, i), batch(1, i), 1e-10);
+}
+
+BOOST_AUTO_TEST_CASE(SkipGramModel_avg_log_prob)
+{
+    SkipGramModel model = get_skipgram_model();
+    const std::vector<int> words{0, 2, 0, 1, 1, 2, 0, 3, 3, 1, 2};
+    for (bool hierarchical : {false, true}) {
+        if (hierarchical)
+            model.set_hierarchical(HuffmanTree(word_counts(words, 4)));
+        // sum of log(p(w_t | c)) over all the (t, c) pairs
+        double expected = 0.0;
+        for (int i = 0;  i < words.size();  ++i)
+            for (int c : get_context(words, i, model.historyN, model.futureN))
+                expected += std::log(model.predict({c}, words[i]));
+        expected /= words.size();
+        for (int threads : {1, 3})
+            BOOST_CHECK_CLOSE(expected, model.avg_log_prob(words, threads), 1e-10);
+        BOOST_CHECK_CLOSE(expected, model.avg_log_prob(Corpus(words)), 1e-10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(estimate_avg_log_prob_exact)
+{
+    const std::vector<int> words{0, 2, 0, 1, 1, 2, 0, 3, 3, 1, 2};
+    const CBOWModel model = get_model();
+    LogProbEstimate estimate = estimate_avg_log_prob(model, words, 100);
+    BOOST_CHECK_CLOSE(model.avg_log_prob(words), estimate.avg_log_prob, 1e-10);
+    BOOST_CHECK_EQUAL(0.0, estimate.error);
+    BOOST_CHECK_EQUAL(words.size(), estimate.samples);
+    const SkipGramModel skipgram = get_skipgram_model();
+    estimate = estimate_avg_log_prob(skipgram, words, words.size());
+    BOOST_CHECK_CLOSE(skipgram.avg_log_prob(words), estimate.avg_log_prob, 1e-10);
+    BOOST_CHECK_EQUAL(0.0, estimate.error);
+}
+
+BOOST_AUTO_TEST_CASE(estimate_avg_log_prob_sampled)
+{
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> dist(0, 3);
+    std::vector<int> words(5000);
+    for (int& w : words)
+        w = dist(rng);
+    const CBOWModel model = get_model();
+    const double exact = model.avg_log_prob(words);
+    const LogProbEstimate estimate = estimate_avg_log_prob(model, words, 500, 7);
+    BOOST_CHECK_EQUAL(500, estimate.samples);
+    BOOST_CHECK(estimate.error > 0.0);
+    BOOST_CHECK(std::abs(estimate.avg_log_prob - exact) < estimate.error);
+    // The same seed draws the same positions
+    const LogProbEstimate again = estimate_avg_log_prob(model, words, 500, 7);
+    BOOST_CHECK_EQUAL(estimate.avg_log_prob, again.avg_log_prob);
+}
+
+BOOST_AUTO_TEST_CASE(SkipGramModel_gradients)
+{
+    SkipGramModel model = get_skipgram_model();
+    const std::vector<int> words{0, 2, 0, 1, 1, 2, 0, 3};
+    help_test_gradients(model, words);
+    model.set_hierarchical(HuffmanTree(word_counts(words, 4)));
+    help_test_gradients(model, words);
+}
+
+BOOST_AUTO_TEST_CASE(SkipGramModel_save_load_binary)
+{
+    const SkipGramModel model = get_skipgram_model();
+    std::stringstream ss;
+    model.save_binary(ss);
+    SkipGramModel model2(1);
+    model2.load_binary(ss);
+    check_equal_models<double>(model, model2);
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_sgd_step_softmax)
+{
+    // With a single predicted word, a step of SGD is a step of gradient descent
+    CBOWModel model = get_model();
+    model.historyN = 1;
+    model.futureN = 0;
+    CBOWModel expected = model;
+    // Only the second word has a context, but gradients are averaged over 2 words
+    expected.update(expected.gradients({2, 1}), 0.5 * 2);
+    SGDWorkspace ws(model.D);
+    model.sgd_step({2}, 1, {}, 0.5, ws);
+    for (int i = 0;  i < 4;  ++i) {
+        for (int j = 0;  j < 3;  ++j) {
+            BOOST_CHECK_CLOSE(expected.P(i, j), model.P(i, j), 1e-9);
+            BOOST_CHECK_CLOSE(expected.O(i, j), model.O(i, j), 1e-9);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CBOWModel_sgd_step_negative)
+{
+    CBOWModel model = get_model();
+    const CBOWModel before = model;
+    SGDWorkspace ws(model.D);
+    const double p = model.predict({1}, 3);
+    model.sgd_step({1}, 3, {0, 3}, 0.5, ws);
+    // Only the context row of P, and the rows of O of the word and the noise
+    // word are updated
+    for (int j = 0;  j < 3;  ++j) {
+        BOOST_CHECK_EQUAL(before.P(0, j), model.P(0, j));
+        BOOST_CHECK(before.P(1, j) != model.P(1, j));
+        BOOST_CHECK_EQUAL(before.P(2, j), model.P(2, j));
+        BOOST_CHECK_EQUAL(before.P(3, j), model.P(3, j));
+        BOOST_CHECK(before.O(0, j) != model.O(0, j));
+        BOOST_CHECK_EQUAL(before.O(1, j), model.O(1, j));
+        BOOST_CHECK_EQUAL(before.O(2, j), model.O(2, j));
+        BOOST_CHECK(before.O(3, j) != model.O(3, j));
+    }
+    BOOST_CHECK(model.predict({1}, 3) > p);
+}
+
 BOOST_AUTO_TEST_CASE(ReportData_constructor)
 {
     ReportData data{10, -0.05, 1.0};
@@ -238,6 +769,42 @@ BOOST_AUTO_TEST_CASE(SimpleReporter_operator_parens)
     BOOST_CHECK_EQUAL("epoch 10 prob -0.05 lr 1\n", ss.str());
 }
 
+BOOST_AUTO_TEST_CASE(SimpleReporter_operator_parens_words_per_sec)
+{
+    ReportData data{10, -0.05, 1.0, 25000.0};
+    std::stringstream ss;
+    SimpleReporter reporter(ss);
+    reporter(data);
+    BOOST_CHECK_EQUAL("epoch 10 prob -0.05 lr 1 words/sec/thread 25000\n", ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(SimpleReporter_operator_parens_error)
+{
+    ReportData data{10, -0.05, 1.0, 0.0, 0.01};
+    std::stringstream ss;
+    SimpleReporter reporter(ss);
+    reporter(data);
+    BOOST_CHECK_EQUAL("epoch 10 prob -0.05 +/- 0.01 lr 1\n", ss.str());
+}
+
+BOOST_AUTO_TEST_CASE(JsonLinesReporter_operator_parens)
+{
+    ReportData data{10, -0.25, 1.0, 25000.0, 0.5, 50000.0, 2.0, 0.125, 0.75, 0.0, 4096};
+    std::stringstream ss;
+    JsonLinesReporter reporter(ss);
+    reporter(data);
+    data.avg_log_prob = -std::numeric_limits<double>::infinity();
+    reporter(data);
+    BOOST_CHECK_EQUAL("{\"epoch\":10,\"avg_log_prob\":-0.25,\"avg_log_prob_error\":0.5,\"lr\":1,"
+                      "\"words_per_sec\":25000,\"examples_per_sec\":50000,\"gradients_seconds\":2,"
+                      "\"update_seconds\":0.125,\"evaluation_seconds\":0.75,\"checkpoint_seconds\":0,"
+                      "\"peak_rss_kb\":4096}\n"
+                      "{\"epoch\":10,\"avg_log_prob\":null,\"avg_log_prob_error\":0.5,\"lr\":1,"
+                      "\"words_per_sec\":25000,\"examples_per_sec\":50000,\"gradients_seconds\":2,"
+                      "\"update_seconds\":0.125,\"evaluation_seconds\":0.75,\"checkpoint_seconds\":0,"
+                      "\"peak_rss_kb\":4096}\n", ss.str());
+}
+
 BOOST_AUTO_TEST_CASE(SimpleLearningRate_constructor_default)
 {
     SimpleLearningRate slr;
@@ -273,6 +840,22 @@ BOOST_AUTO_TEST_CASE(Trainer_constructor)
     BOOST_CHECK_EQUAL(50, trainer.D);
     BOOST_CHECK_EQUAL(4, trainer.historyN);
     BOOST_CHECK_EQUAL(4, trainer.futureN);
+    BOOST_CHECK_EQUAL(false, trainer.hierarchical);
+    BOOST_CHECK_EQUAL(0, trainer.negative);
+    BOOST_CHECK_EQUAL(false, trainer.online);
+    BOOST_CHECK_EQUAL(1, trainer.threads);
+    BOOST_CHECK_EQUAL(0.0, trainer.sample);
+    BOOST_CHECK_EQUAL(1, trainer.processes);
+    BOOST_CHECK_EQUAL(100000, trainer.syncInterval);
+    BOOST_CHECK_EQUAL(0, trainer.seed);
+    BOOST_CHECK(trainer.validation.empty());
+    BOOST_CHECK_EQUAL(0, trainer.validationSamples);
+    BOOST_CHECK_EQUAL(0, trainer.patience);
+    BOOST_CHECK_EQUAL(0.0, trainer.minDelta);
+    BOOST_CHECK_EQUAL("", trainer.checkpointPath);
+    BOOST_CHECK_EQUAL(1, trainer.checkpointEpochs);
+    BOOST_CHECK_EQUAL(0.0, trainer.checkpointSeconds);
+    BOOST_CHECK_EQUAL(false, trainer.resume);
     BOOST_CHECK_EQUAL(nullptr, trainer.initReporter);
     BOOST_CHECK_EQUAL(nullptr, trainer.epochReporter);
     BOOST_CHECK_EQUAL(nullptr, trainer.exitReporter);
@@ -286,6 +869,7 @@ BOOST_AUTO_TEST_CASE(Trainer_setters)
     SimpleReporter epochReporter(ss);
     SimpleReporter exitReporter(ss);
     SimpleLearningRate learningRate;
+    const std::vector<int> validation{1, 2, 3};
     Trainer trainer;
     trainer.setEpochs(20)
            .setEmbeddingSize(640)
@@ -294,7 +878,19 @@ BOOST_AUTO_TEST_CASE(Trainer_setters)
            .setInitReporter(&initReporter)
            .setEpochReporter(&epochReporter)
            .setExitReporter(&exitReporter)
-           .setLearningRate(&learningRate);
+           .setLearningRate(&learningRate)
+           .setHierarchicalSoftmax(true)
+           .setNegative(5)
+           .setOnline(true)
+           .setThreads(8)
+           .setSample(1e-4)
+           .setProcesses(3, 5000)
+           .setSeed(42)
+           .setValidation(validation)
+           .setValidationSamples(1000)
+           .setEarlyStopping(3, 1e-3)
+           .setCheckpoint("model.ckpt", 2, 60.0)
+           .setResume(true);
     BOOST_CHECK_EQUAL(20, trainer.epochs);
     BOOST_CHECK_EQUAL(640, trainer.D);
     BOOST_CHECK_EQUAL(9, trainer.historyN);
@@ -303,6 +899,22 @@ BOOST_AUTO_TEST_CASE(Trainer_setters)
     BOOST_CHECK_EQUAL(&epochReporter, trainer.epochReporter);
     BOOST_CHECK_EQUAL(&exitReporter, trainer.exitReporter);
     BOOST_CHECK_EQUAL(&learningRate, trainer.learningRate);
+    BOOST_CHECK_EQUAL(true, trainer.hierarchical);
+    BOOST_CHECK_EQUAL(5, trainer.negative);
+    BOOST_CHECK_EQUAL(true, trainer.online);
+    BOOST_CHECK_EQUAL(8, trainer.threads);
+    BOOST_CHECK_EQUAL(1e-4, trainer.sample);
+    BOOST_CHECK_EQUAL(3, trainer.processes);
+    BOOST_CHECK_EQUAL(5000, trainer.syncInterval);
+    BOOST_CHECK_EQUAL(42, trainer.seed);
+    BOOST_CHECK_EQUAL(3, trainer.validation.size());
+    BOOST_CHECK_EQUAL(1000, trainer.validationSamples);
+    BOOST_CHECK_EQUAL(3, trainer.patience);
+    BOOST_CHECK_EQUAL(1e-3, trainer.minDelta);
+    BOOST_CHECK_EQUAL("model.ckpt", trainer.checkpointPath);
+    BOOST_CHECK_EQUAL(2, trainer.checkpointEpochs);
+    BOOST_CHECK_EQUAL(60.0, trainer.checkpointSeconds);
+    BOOST_CHECK_EQUAL(true, trainer.resume);
 }
 
 BOOST_AUTO_TEST_CASE(Trainer_train)
@@ -333,3 +945,390 @@ BOOST_AUTO_TEST_CASE(Trainer_train)
     // BOOST_CHECK_EQUAL(std::string(""), ss.str());
 }
 
+
+BOOST_AUTO_TEST_CASE(Trainer_train_hierarchical)
+{
+    SimpleLearningRate learningRate(1.0, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setHierarchicalSoftmax(true);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    CBOWModel model = trainer.train(words);
+    BOOST_CHECK(model.hierarchical());
+    // The untrained model predicts each of the 4 words with p = 1/4
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(0.25));
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_negative)
+{
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setNegative(2);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    CBOWModel model = trainer.train(words);
+    BOOST_CHECK(!model.hierarchical());
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(0.25));
+    // Both would train the same rows of O
+    trainer.setHierarchicalSoftmax(true);
+    BOOST_CHECK_THROW(trainer.train(words), std::runtime_error);
+    BOOST_CHECK_THROW(trainer.train_skipgram(words), std::runtime_error);
+}
+
+// A reporter that records everything it receives
+struct RecordingReporter : public Reporter {
+    virtual void operator()(const ReportData& data) const override { records.push_back(data); }
+    mutable std::vector<ReportData> records;
+};
+
+BOOST_AUTO_TEST_CASE(Trainer_train_validation)
+{
+    RecordingReporter reporter;
+    SimpleLearningRate learningRate(1.0, 100);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    const std::vector<int> validation{1, 2, 3, 0, 1};
+    Trainer trainer;
+    trainer.setEpochs(3)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setHierarchicalSoftmax(true)
+           .setExitReporter(&reporter)
+           .setValidation(validation);
+    CBOWModel model = trainer.train(words);
+    BOOST_REQUIRE_EQUAL(1, reporter.records.size());
+    BOOST_CHECK_CLOSE(model.avg_log_prob(validation), reporter.records[0].avg_log_prob, 1e-10);
+    BOOST_CHECK_EQUAL(0.0, reporter.records[0].avg_log_prob_error);
+    trainer.setValidationSamples(3);
+    model = trainer.train(words);
+    BOOST_REQUIRE_EQUAL(2, reporter.records.size());
+    BOOST_CHECK_CLOSE(estimate_avg_log_prob(model, validation, 3, trainer.seed).avg_log_prob,
+                      reporter.records[1].avg_log_prob, 1e-10);
+    BOOST_CHECK(reporter.records[1].avg_log_prob_error > 0.0);
+    const std::vector<int> unknown{4};
+    trainer.setValidation(unknown);
+    BOOST_CHECK_THROW(trainer.train(words), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_metrics)
+{
+    RecordingReporter reporter;
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    Trainer trainer;
+    trainer.setEpochs(1)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setInitReporter(&reporter)
+           .setEpochReporter(&reporter)
+           .setExitReporter(&reporter);
+    for (bool online : {false, true}) {
+        reporter.records.clear();
+        trainer.setOnline(online).train_skipgram(words);
+        BOOST_REQUIRE_EQUAL(4, reporter.records.size());
+        for (const ReportData& data : reporter.records)
+            BOOST_CHECK(data.peak_rss_kb > 0);
+        const ReportData& epoch = reporter.records[1];
+        BOOST_CHECK(epoch.words_per_sec > 0.0);
+        // 22 (context word, word) pairs per epoch
+        BOOST_CHECK_CLOSE(epoch.examples_per_sec, epoch.words_per_sec * 22 / 12, 1e-6);
+        BOOST_CHECK(epoch.gradients_seconds > 0.0);
+        BOOST_CHECK_EQUAL(online, epoch.update_seconds == 0.0);
+        BOOST_CHECK(epoch.evaluation_seconds > 0.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_processes)
+{
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setNegative(2)
+           .setProcesses(2, 4);
+    std::vector<int> words;
+    for (int i = 0;  i < 6;  ++i)
+        words.insert(words.end(), {0, 1, 2, 3});
+    const CBOWModel model = trainer.train(words);
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(0.25));
+}
+
+// The ids of the child processes of this process
+std::vector<pid_t> child_pids()
+{
+    std::vector<pid_t> ret;
+    for (const auto& entry : std::filesystem::directory_iterator("/proc")) {
+        std::ifstream is(entry.path() / "stat");
+        std::string comm, state;
+        pid_t pid, ppid;
+        // comm is in parentheses and has no spaces here
+        if (is >> pid >> comm >> state >> ppid && ppid == getpid())
+            ret.push_back(pid);
+    }
+    return ret;
+}
+
+// Kills one child process after the first epoch
+struct KillingReporter : public Reporter {
+    virtual void operator()(const ReportData& data) const override
+    {
+        if (data.epoch != 1)
+            return;
+        const std::vector<pid_t> pids = child_pids();
+        BOOST_REQUIRE_EQUAL(2, pids.size());
+        kill(pids[0], SIGKILL);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Trainer_train_processes_worker_dies)
+{
+    KillingReporter reporter;
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setHierarchicalSoftmax(true)
+           .setEpochReporter(&reporter)
+           .setProcesses(2, 3);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    const CBOWModel model = trainer.train(words);
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(0.25));
+    BOOST_CHECK(child_pids().empty());
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_early_stopping)
+{
+    RecordingReporter reporter;
+    // A learning rate of 0 never improves the model
+    SimpleLearningRate learningRate(0.0);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setEpochReporter(&reporter)
+           .setEarlyStopping(3);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    trainer.train(words);
+    BOOST_CHECK_EQUAL(3, reporter.records.size());
+    learningRate.lr = 1.0;
+    learningRate.cutoff = 100;
+    reporter.records.clear();
+    trainer.setEpochs(5).train(words);
+    BOOST_CHECK_EQUAL(6, reporter.records.size());
+}
+
+BOOST_AUTO_TEST_CASE(save_load_checkpoint)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_save_load_checkpoint").string();
+    const FloatCBOWModel model = to_float(get_model());
+    save_checkpoint(path, model, {7, -1.5, 2});
+    BOOST_CHECK(!std::filesystem::exists(path + ".tmp"));
+    FloatCBOWModel got(1);
+    const CheckpointState state = load_checkpoint(path, got);
+    std::remove(path.c_str());
+    BOOST_CHECK_EQUAL(7, state.epoch);
+    BOOST_CHECK_EQUAL(-1.5, state.best_avg_log_prob);
+    BOOST_CHECK_EQUAL(2, state.stale_epochs);
+    check_equal_models(model, got);
+    BOOST_CHECK_THROW(load_checkpoint(path, got), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_checkpoint_resume)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Trainer_train_checkpoint_resume").string();
+    std::remove(path.c_str());
+    RecordingReporter reporter;
+    SimpleLearningRate learningRate(1.0, 2);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    Trainer trainer;
+    trainer.setEpochs(4)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate);
+    const CBOWModel expected = trainer.train(words);
+    // Interrupted after 3 epochs, then resumed
+    trainer.setEpochs(2)
+           .setCheckpoint(path)
+           .setResume(true)
+           .train(words);
+    CBOWModel checkpoint(1);
+    BOOST_CHECK_EQUAL(3, load_checkpoint(path, checkpoint).epoch);
+    trainer.setEpochs(4)
+           .setInitReporter(&reporter);
+    const CBOWModel got = trainer.train(words);
+    std::remove(path.c_str());
+    BOOST_REQUIRE_EQUAL(1, reporter.records.size());
+    BOOST_CHECK_EQUAL(3, reporter.records[0].epoch);
+    BOOST_CHECK_EQUAL(learningRate(3), reporter.records[0].lr);
+    check_equal_models(expected, got);
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_checkpoint_resume_mismatch)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Trainer_train_checkpoint_resume_mismatch").string();
+    std::remove(path.c_str());
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    Trainer trainer;
+    trainer.setEpochs(1)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setCheckpoint(path)
+           .setResume(true)
+           .train(words);
+    BOOST_CHECK_THROW(Trainer(trainer).setEmbeddingSize(5).train(words), std::runtime_error);
+    BOOST_CHECK_THROW(Trainer(trainer).setHistoryN(2).train(words), std::runtime_error);
+    BOOST_CHECK_THROW(Trainer(trainer).setFutureN(0).train(words), std::runtime_error);
+    BOOST_CHECK_THROW(Trainer(trainer).setHierarchicalSoftmax(true).train(words), std::runtime_error);
+    BOOST_CHECK_THROW(trainer.train(std::vector<int>{0, 1, 2, 3, 4, 0, 1, 2, 3, 4}), std::runtime_error);
+    trainer.setEpochs(2).train(words);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_corpus_file)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "toynet_Trainer_train_corpus_file").string();
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 1};
+    {
+        CorpusWriter writer(path);
+        writer.write(words);
+    }
+    const Corpus corpus(path);
+    std::remove(path.c_str());
+    for (bool hierarchical : {false, true}) {
+        Trainer trainer;
+        trainer.setEpochs(3)
+               .setEmbeddingSize(4)
+               .setHistoryN(2)
+               .setFutureN(1)
+               .setHierarchicalSoftmax(hierarchical);
+        const CBOWModel expected = trainer.train(words);
+        const CBOWModel got = trainer.train(corpus);
+        check_equal_models(expected, got);
+        BOOST_CHECK_CLOSE(expected.avg_log_prob(words), got.avg_log_prob(corpus, 2), 1e-10);
+        const CBOWModelGradients g1 = expected.gradients(words);
+        const CBOWModelGradients g2 = expected.gradients(corpus);
+        BOOST_CHECK(ublas::norm_frobenius(g1.P.dense() - g2.P.dense()) == 0.0);
+        BOOST_CHECK(ublas::norm_frobenius(g1.O.dense() - g2.O.dense()) == 0.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_corpus_out_of_range)
+{
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3};
+    Corpus corpus(words);
+    corpus.W = 3;
+    corpus.counts.resize(3);
+    Trainer trainer;
+    trainer.setEpochs(1)
+           .setEmbeddingSize(4);
+    BOOST_CHECK_THROW(trainer.train(corpus), std::runtime_error);
+    BOOST_CHECK_THROW(trainer.train_skipgram(corpus), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_vocabulary_sample)
+{
+    // id 9 is rare and dropped; id 7 is very frequent and subsampled
+    std::vector<int> ids;
+    for (int i = 0;  i < 200;  ++i) {
+        ids.push_back(7);
+        ids.push_back(i % 2 ? 3 : 5);
+        ids.push_back(7);
+    }
+    ids.push_back(9);
+    const Vocabulary vocab(Corpus(ids).counts, 2);
+    BOOST_REQUIRE_EQUAL(3, vocab.size());
+    const std::vector<int> words = vocab.apply(Corpus(ids));
+    BOOST_CHECK_EQUAL(600, words.size());
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(5)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setHierarchicalSoftmax(true)
+           .setSample(0.1);
+    BOOST_CHECK(trainer.uses_sgd());
+    const CBOWModel model = trainer.train(words);
+    BOOST_CHECK_EQUAL(3, model.W);
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(1.0 / 3));
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_skipgram)
+{
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setNegative(2);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    const SkipGramModel model = trainer.train_skipgram(words);
+    BOOST_CHECK(model.avg_log_prob(words) > 2 * std::log(0.25));
+    // Word 1 is always between words 0 and 2
+    const auto top = model.predict_topk(1, 2);
+    BOOST_CHECK(std::set<int>({0, 2}) == std::set<int>({top[0].second, top[1].second}));
+    const FloatSkipGramModel fmodel = trainer.setThreads(2).setOnline(true).train_skipgram<float>(Corpus(words));
+    BOOST_CHECK(fmodel.avg_log_prob(words) > 2 * std::log(0.25));
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_float)
+{
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setNegative(2);
+    const std::vector<int> words{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3};
+    FloatCBOWModel model = trainer.train<float>(words);
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(0.25));
+    // Same random numbers, so close to the double precision model
+    CBOWModel expected = trainer.train(words);
+    BOOST_CHECK_CLOSE(model.avg_log_prob(words), expected.avg_log_prob(words), 0.1);
+}
+
+BOOST_AUTO_TEST_CASE(Trainer_train_hogwild)
+{
+    std::stringstream ss;
+    SimpleReporter epochReporter(ss);
+    SimpleLearningRate learningRate(0.5, 100);
+    Trainer trainer;
+    trainer.setEpochs(20)
+           .setEmbeddingSize(4)
+           .setHistoryN(1)
+           .setFutureN(1)
+           .setLearningRate(&learningRate)
+           .setEpochReporter(&epochReporter)
+           .setOnline(true)
+           .setThreads(3);
+    std::vector<int> words;
+    for (int i = 0;  i < 10;  ++i)
+        words.insert(words.end(), {0, 1, 2, 3});
+    CBOWModel model = trainer.train(words);
+    BOOST_CHECK(model.avg_log_prob(words) > std::log(0.25));
+    BOOST_CHECK(ss.str().find("words/sec/thread") != std::string::npos);
+}
@@ -0,0 +1,112 @@
+#include <toynet/word2vec.h>
+#include <toynet/mapped_file.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+
+namespace toynet {
+
+namespace {
+
+bool is_space(char c)
+{
+    return std::isspace(static_cast<unsigned char>(c));
+}
+
+} // namespace
+
+template<class T>
+void save_word2vec(std::ostream& os, const BasicCBOWModel<T>& model, const std::vector<std::string>& words)
+{
+    if (!words.empty() && words.size() != model.W)
+        throw std::runtime_error("save_word2vec: expected " + std::to_string(model.W) + " words");
+    for (const std::string& word : words)
+        if (word.empty() || std::any_of(word.begin(), word.end(), is_space))
+            throw std::runtime_error("save_word2vec: invalid word \"" + word + "\"");
+    os << model.W << " " << model.D << "\n";
+    std::vector<float> row(model.D);
+    for (int w = 0;  w < model.W;  ++w) {
+        os << (words.empty() ? std::to_string(w) : words[w]) << " ";
+        for (int j = 0;  j < model.D;  ++j)
+            row[j] = model.P(w, j);
+        os.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        os << "\n";
+    }
+}
+
+template void save_word2vec(std::ostream&, const BasicCBOWModel<float>&, const std::vector<std::string>&);
+template void save_word2vec(std::ostream&, const BasicCBOWModel<double>&, const std::vector<std::string>&);
+
+Word2VecFile::Word2VecFile(const std::string& path)
+    : D(0)
+    , file(std::make_shared<MappedFile>(path))
+{
+    const char* p = file->data;
+    const char* end = file->data + file->size;
+    // Header: "W D\n"
+    const char* eol = std::find(p, end, '\n');
+    long W = -1;
+    long d = -1;
+    if (eol == end || std::sscanf(std::string(p, eol).c_str(), "%ld %ld", &W, &d) != 2 || W < 0 || d <= 0
+        || W > std::numeric_limits<int>::max() || d > std::numeric_limits<int>::max())
+        throw std::runtime_error("Word2VecFile: invalid header in " + path);
+    D = d;
+    p = eol + 1;
+    const std::size_t row_size = std::size_t(D) * sizeof(float);
+    // Each word takes at least a 1-byte name, a space and its row, so that a
+    // corrupt W cannot make us reserve more than the file could hold
+    if (std::size_t(W) > file->size / (row_size + 2))
+        throw std::runtime_error("Word2VecFile: truncated file " + path);
+    words.reserve(W);
+    rows.reserve(W);
+    for (long w = 0;  w < W;  ++w) {
+        // Some writers put the newline before each word instead of after
+        // each row
+        while (p < end && is_space(*p))
+            ++p;
+        const char* name = p;
+        while (p < end && *p != ' ')
+            ++p;
+        if (p == name || end - p < 1 + std::ptrdiff_t(row_size))
+            throw std::runtime_error("Word2VecFile: truncated file " + path);
+        words.emplace_back(name, p);
+        index.emplace(words.back(), w);
+        rows.push_back(p + 1);
+        p += 1 + row_size;
+    }
+}
+
+template<class T>
+void Word2VecFile::copy_row(int i, T* out) const
+{
+    for (int j = 0;  j < D;  ++j)
+        out[j] = (*this)(i, j);
+}
+
+template void Word2VecFile::copy_row(int, float*) const;
+template void Word2VecFile::copy_row(int, double*) const;
+
+int Word2VecFile::find(const std::string& word) const
+{
+    const auto it = index.find(word);
+    return it == index.end() ? -1 : it->second;
+}
+
+template<class T>
+void load_word2vec(const Word2VecFile& file, BasicCBOWModel<T>& model)
+{
+    model.W = file.size();
+    model.D = file.D;
+    model.P.resize(model.W, model.D, false);
+    for (int w = 0;  w < model.W;  ++w)
+        file.copy_row(w, &model.P(w, 0));
+    model.O = ublas::zero_matrix<T>(model.W, model.D);
+    model.tree = HuffmanTree();
+}
+
+template void load_word2vec(const Word2VecFile&, BasicCBOWModel<float>&);
+template void load_word2vec(const Word2VecFile&, BasicCBOWModel<double>&);
+
+} // namespace toynet
@@ -0,0 +1,70 @@
+#include <toynet/w2v.h>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace toynet {
+
+struct MappedFile;
+
+// Save the embeddings `model.P` in the binary format of the word2vec
+// implementation (https://code.google.com/archive/p/word2vec/): a text
+// header "W D\n", followed for each word by its name, a space, its D
+// coordinates as little-endian float32, and a newline.  The name of word `w`
+// is `words[w]`, or the decimal index `w` if `words` is empty.
+// Throws std::runtime_error if `words` does not have W elements, or if a name
+// is empty or contains whitespace.
+template<class T>
+void save_word2vec(std::ostream& os, const BasicCBOWModel<T>& model, const std::vector<std::string>& words={});
+
+// A memory-mapped embedding file in the binary format of the word2vec
+// implementation (see `save_word2vec`).  Opening the file only scans the
+// word names; the coordinates are read in place from the mapping, without
+// copying the file.  The rows are not aligned (they follow variable-length
+// names), so they are read through `operator()` and `copy_row` rather than
+// through pointers.
+struct Word2VecFile {
+    // Map and index the file at `path`.
+    // Throws std::runtime_error if the file cannot be read or is malformed.
+    explicit Word2VecFile(const std::string& path);
+
+    // The number of words, i.e. W
+    int size() const { return words.size(); }
+
+    // Coordinate `j` of word `i`
+    // Pre-conditions: 0 <= i < size(), 0 <= j < D
+    float operator()(int i, int j) const
+    {
+        float x;
+        std::memcpy(&x, rows[i] + std::size_t(j) * sizeof(float), sizeof(float));
+        return x;
+    }
+
+    // Copy the D coordinates of word `i` to `out`
+    template<class T>
+    void copy_row(int i, T* out) const;
+
+    // The index of the word named `word`, or -1
+    int find(const std::string& word) const;
+
+    int D;
+    // words[i] is the name of word `i`
+    std::vector<std::string> words;
+    // rows[i] points to the coordinates of word `i` in the mapping
+    std::vector<const char*> rows;
+    // index[words[i]] == i; the first occurrence wins for duplicate names
+    std::unordered_map<std::string, int> index;
+    std::shared_ptr<MappedFile> file;
+};
+
+// Load the embeddings of a word2vec file into `model`: W and D are taken from
+// the file, P is set to the embeddings, O is set to zero and the hierarchical
+// softmax is removed, since the format only stores the embeddings.
+template<class T>
+void load_word2vec(const Word2VecFile& file, BasicCBOWModel<T>& model);
+
+} // namespace toynet
@@ -0,0 +1,111 @@
+#include <toynet/word2vec.h>
+#include <toynet/stlio.h>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/test/unit_test.hpp>
+
+using namespace toynet;
+
+namespace {
+
+FloatCBOWModel get_word2vec_model()
+{
+    FloatCBOWModel model(3, 2);
+    for (int i = 0;  i < 3;  ++i)
+        for (int j = 0;  j < 2;  ++j)
+            model.P(i, j) = i - 0.25f * j;
+    return model;
+}
+
+std::string write_file(const std::string& name, const std::string& contents)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / name).string();
+    std::ofstream os(path, std::ios::binary);
+    os << contents;
+    return path;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(save_word2vec_format)
+{
+    const FloatCBOWModel model = get_word2vec_model();
+    std::stringstream ss;
+    save_word2vec(ss, model, {"the", "cat", "sat"});
+    const std::string s = ss.str();
+    // header, then 3 x (name, space, 2 floats, newline)
+    BOOST_REQUIRE_EQUAL(4 + 3 * (3 + 1 + 2 * 4 + 1), s.size());
+    BOOST_CHECK_EQUAL("3 2\nthe ", s.substr(0, 8));
+    float x[2];
+    std::memcpy(x, s.data() + 4 + 13 + 4, sizeof(x));  // "cat"
+    BOOST_CHECK_EQUAL(1.0f, x[0]);
+    BOOST_CHECK_EQUAL(0.75f, x[1]);
+    BOOST_CHECK_EQUAL('\n', s.back());
+    BOOST_CHECK_THROW(save_word2vec(ss, model, {"the", "cat"}), std::runtime_error);
+    BOOST_CHECK_THROW(save_word2vec(ss, model, {"the", "black cat", "sat"}), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(Word2VecFile_round_trip)
+{
+    const CBOWModel model(3, 4);  // random embeddings
+    std::stringstream ss;
+    save_word2vec(ss, model);
+    const std::string path = write_file("toynet_Word2VecFile_round_trip", ss.str());
+    const Word2VecFile file(path);
+    std::remove(path.c_str());
+    BOOST_REQUIRE_EQUAL(model.W, file.size());
+    BOOST_REQUIRE_EQUAL(model.D, file.D);
+    BOOST_CHECK_EQUAL(std::vector<std::string>({"0", "1", "2"}), file.words);
+    BOOST_CHECK_EQUAL(2, file.find("2"));
+    BOOST_CHECK_EQUAL(-1, file.find("3"));
+    for (int i = 0;  i < model.W;  ++i)
+        for (int j = 0;  j < model.D;  ++j)
+            BOOST_CHECK_EQUAL(float(model.P(i, j)), file(i, j));
+    FloatCBOWModel loaded(1);
+    load_word2vec(file, loaded);
+    BOOST_CHECK_EQUAL(model.W, loaded.W);
+    BOOST_CHECK_EQUAL(model.D, loaded.D);
+    BOOST_CHECK(!loaded.hierarchical());
+    for (int i = 0;  i < model.W;  ++i) {
+        for (int j = 0;  j < model.D;  ++j) {
+            BOOST_CHECK_EQUAL(float(model.P(i, j)), loaded.P(i, j));
+            BOOST_CHECK_EQUAL(0.0f, loaded.O(i, j));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Word2VecFile_newline_before_words)
+{
+    // The rows of some writers end without a newline
+    std::string contents = "2 1\n";
+    const float x[2] = {1.5f, -2.0f};
+    contents += "a ";
+    contents.append(reinterpret_cast<const char*>(&x[0]), 4);
+    contents += "\nb ";
+    contents.append(reinterpret_cast<const char*>(&x[1]), 4);
+    const std::string path = write_file("toynet_Word2VecFile_newline_before_words", contents);
+    const Word2VecFile file(path);
+    std::remove(path.c_str());
+    BOOST_CHECK_EQUAL(std::vector<std::string>({"a", "b"}), file.words);
+    BOOST_CHECK_EQUAL(1.5f, file(0, 0));
+    BOOST_CHECK_EQUAL(-2.0f, file(1, 0));
+}
+
+BOOST_AUTO_TEST_CASE(Word2VecFile_errors)
+{
+    std::string path = write_file("toynet_Word2VecFile_errors", "not a header\n");
+    BOOST_CHECK_THROW(Word2VecFile file(path), std::runtime_error);
+    path = write_file("toynet_Word2VecFile_errors", "2 4\nword 1234");
+    BOOST_CHECK_THROW(Word2VecFile file(path), std::runtime_error);
+    // W larger than the file could hold, or than an int
+    path = write_file("toynet_Word2VecFile_errors", "100000000000 5\nword 12345678901234567890");
+    BOOST_CHECK_THROW(Word2VecFile file(path), std::runtime_error);
+    path = write_file("toynet_Word2VecFile_errors", "1000000 5\nword 12345678901234567890");
+    BOOST_CHECK_THROW(Word2VecFile file(path), std::runtime_error);
+    std::remove(path.c_str());
+    BOOST_CHECK_THROW(Word2VecFile file(path), std::runtime_error);
+}